@@ -0,0 +1,23 @@
+#pragma once
+
+// Shared support for the do_*_base benchmarks. Include this ahead of the
+// benchmark sources.
+
+#include "base_config.hpp"
+#include "base_cache.hpp"
+#include "base_memory.hpp"
+#include "base_timer.hpp"
+#include "base_stats.hpp"
+#include "base_session.hpp"
+#include "base_buffer.hpp"
+#include "base_tune.hpp"
+#include "base_coexec.hpp"
+#include "base_mandelbrot.hpp"
+#include "base_bvh.hpp"
+#include "base_scene.hpp"
+#include "base_native.hpp"
+#include "base_random.hpp"
+#include "base_image.hpp"
+#include "base_verify.hpp"
+#include "base_diff.hpp"
+#include "base_sweep.hpp"
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "base_memory.hpp"
+#include "base_session.hpp"
+
+// Host storage and device buffers for the do_*_base benchmarks.
+//
+// BaseAlignedAllocator hands out page-aligned storage rounded up to whole
+// pages, which is what zero-copy CL_MEM_USE_HOST_PTR needs on CPU and
+// integrated devices. BaseBuffer wraps a cl::Buffer with one of three
+// strategies (config.buffer_strategy):
+//
+//   copy            device buffer, enqueueWriteBuffer/enqueueReadBuffer
+//   use_host_ptr    CL_MEM_USE_HOST_PTR over the host array, map/unmap to sync
+//   alloc_host_ptr  CL_MEM_ALLOC_HOST_PTR, filled and drained through map/unmap
+//
+// Bytes moved by the API copies (copy) or by host memcpy into and out of the
+// mapped region (alloc_host_ptr) are added to the "bytes_copied" counter of the
+// session timer. use_host_ptr adds nothing; a discrete device may still copy
+// behind the runtime's back. Buffer sizes add to the "device_bytes" counter and
+// host arrays to base_host_memory().
+
+inline size_t
+base_page_size()
+{
+  static const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+template<typename T>
+struct BaseAlignedAllocator
+{
+  typedef T value_type;
+
+  BaseAlignedAllocator() = default;
+
+  template<typename U>
+  BaseAlignedAllocator(const BaseAlignedAllocator<U>&)
+  {}
+
+  T*
+  allocate(size_t n)
+  {
+    auto page_size = base_page_size();
+    auto bytes = (n * sizeof(T) + page_size - 1) / page_size * page_size;
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, page_size, bytes ? bytes : page_size) != 0) {
+      throw bad_alloc();
+    }
+    base_host_memory().add(bytes);
+    return static_cast<T*>(ptr);
+  }
+
+  void
+  deallocate(T* ptr, size_t n)
+  {
+    auto page_size = base_page_size();
+    base_host_memory().sub((n * sizeof(T) + page_size - 1) / page_size * page_size);
+    free(ptr);
+  }
+
+  template<typename U>
+  bool
+  operator==(const BaseAlignedAllocator<U>&) const
+  {
+    return true;
+  }
+
+  template<typename U>
+  bool
+  operator!=(const BaseAlignedAllocator<U>&) const
+  {
+    return false;
+  }
+};
+
+template<typename T>
+using base_vector = vector<T, BaseAlignedAllocator<T>>;
+
+enum class BaseBufferStrategy
+{
+  copy,
+  use_host_ptr,
+  alloc_host_ptr
+};
+
+inline BaseBufferStrategy
+base_buffer_strategy(const string& name)
+{
+  if (name.empty() || name == "copy") {
+    return BaseBufferStrategy::copy;
+  }
+  if (name == "use_host_ptr") {
+    return BaseBufferStrategy::use_host_ptr;
+  }
+  if (name == "alloc_host_ptr") {
+    return BaseBufferStrategy::alloc_host_ptr;
+  }
+  throw runtime_error("invalid buffer strategy: " + name);
+}
+
+struct BaseBuffer
+{
+  BaseSession& session;
+  BaseBufferStrategy strategy;
+  size_t bytes;
+  void* host_ptr;
+  cl::Buffer buffer;
+
+  BaseBuffer(BaseSession& session, cl_mem_flags flags, size_t bytes, void* host_ptr)
+    : session(session)
+    , strategy(base_buffer_strategy(session.config.buffer_strategy))
+    , bytes(bytes)
+    , host_ptr(host_ptr)
+  {
+    cl_int cl_err = CL_SUCCESS;
+    switch (strategy) {
+      case BaseBufferStrategy::copy:
+        buffer = cl::Buffer(session.context, flags, bytes, NULL, &cl_err);
+        break;
+      case BaseBufferStrategy::use_host_ptr:
+        buffer = cl::Buffer(session.context, flags | CL_MEM_USE_HOST_PTR, bytes, host_ptr, &cl_err);
+        break;
+      case BaseBufferStrategy::alloc_host_ptr:
+        buffer = cl::Buffer(session.context, flags | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &cl_err);
+        break;
+    }
+    CL_CHECK_ERROR(cl_err, "buffer");
+    session.timer.count("device_bytes", bytes);
+  }
+
+  // Makes the host contents visible to the device. Non-blocking for copy; with
+  // done set the copy's event is appended to it.
+  cl_int
+  upload(cl::CommandQueue& queue, vector<cl::Event>* done = nullptr)
+  {
+    cl_int cl_err = CL_SUCCESS;
+    switch (strategy) {
+      case BaseBufferStrategy::copy:
+        if (done) {
+          cl::Event written;
+          cl_err = queue.enqueueWriteBuffer(buffer, CL_FALSE, 0, bytes, host_ptr, NULL, &written);
+          if (cl_err == CL_SUCCESS) {
+            session.traced("write", queue, written);
+            done->push_back(written);
+          }
+        } else {
+          cl_err = queue.enqueueWriteBuffer(
+            buffer, CL_FALSE, 0, bytes, host_ptr, NULL, session.event("write", queue));
+        }
+        session.timer.count("bytes_copied", bytes);
+        break;
+      case BaseBufferStrategy::use_host_ptr:
+        // the buffer was created over the host array
+        break;
+      case BaseBufferStrategy::alloc_host_ptr: {
+        auto ptr = queue.enqueueMapBuffer(buffer,
+                                          CL_TRUE,
+                                          CL_MAP_WRITE_INVALIDATE_REGION,
+                                          0,
+                                          bytes,
+                                          NULL,
+                                          session.event("map", queue),
+                                          &cl_err);
+        if (cl_err != CL_SUCCESS) {
+          return cl_err;
+        }
+        memcpy(ptr, host_ptr, bytes);
+        session.timer.count("bytes_copied", bytes);
+        cl_err = queue.enqueueUnmapMemObject(buffer, ptr, NULL, session.event("unmap", queue));
+        break;
+      }
+    }
+    return cl_err;
+  }
+
+  // Makes the device contents visible in the host array. Always blocking.
+  cl_int
+  download(cl::CommandQueue& queue)
+  {
+    return download(queue, 0, bytes);
+  }
+
+  // Same for the byte range [offset, offset + size) only.
+  cl_int
+  download(cl::CommandQueue& queue, size_t offset, size_t size)
+  {
+    return download(queue, offset, size, NULL, nullptr);
+  }
+
+  // Same after the events of wait. With done set, a copy does not block and
+  // appends its event to done; the map strategies always block.
+  cl_int
+  download(cl::CommandQueue& queue,
+           size_t offset,
+           size_t size,
+           const vector<cl::Event>* wait,
+           vector<cl::Event>* done)
+  {
+    cl_int cl_err = CL_SUCCESS;
+    auto host_range = static_cast<char*>(host_ptr) + offset;
+    switch (strategy) {
+      case BaseBufferStrategy::copy:
+        if (done) {
+          cl::Event read;
+          cl_err = queue.enqueueReadBuffer(buffer, CL_FALSE, offset, size, host_range, wait, &read);
+          if (cl_err == CL_SUCCESS) {
+            session.traced("read", queue, read);
+            done->push_back(read);
+          }
+        } else {
+          cl_err = queue.enqueueReadBuffer(
+            buffer, CL_TRUE, offset, size, host_range, wait, session.event("read", queue));
+        }
+        session.timer.count("bytes_copied", size);
+        break;
+      case BaseBufferStrategy::use_host_ptr: {
+        auto ptr = queue.enqueueMapBuffer(
+          buffer, CL_TRUE, CL_MAP_READ, offset, size, wait, session.event("map", queue), &cl_err);
+        if (cl_err != CL_SUCCESS) {
+          return cl_err;
+        }
+        if (ptr != host_range) {
+          // only happens if the runtime ignored the host pointer
+          memcpy(host_range, ptr, size);
+          session.timer.count("bytes_copied", size);
+        }
+        cl_err = queue.enqueueUnmapMemObject(buffer, ptr, NULL, session.event("unmap", queue));
+        break;
+      }
+      case BaseBufferStrategy::alloc_host_ptr: {
+        auto ptr = queue.enqueueMapBuffer(
+          buffer, CL_TRUE, CL_MAP_READ, offset, size, wait, session.event("map", queue), &cl_err);
+        if (cl_err != CL_SUCCESS) {
+          return cl_err;
+        }
+        memcpy(host_range, ptr, size);
+        session.timer.count("bytes_copied", size);
+        cl_err = queue.enqueueUnmapMemObject(buffer, ptr, NULL, session.event("unmap", queue));
+        break;
+      }
+    }
+    return cl_err;
+  }
+};
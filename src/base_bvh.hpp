@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "base_buffer.hpp"
+
+// Bounding volume hierarchy over the ray tracer primitives.
+//
+// Spheres are split with a binned SAH into a flattened node array: a node is 32
+// bytes (two per 64-byte line), its children are stored next to each other, and
+// the primitives are reordered so that every leaf covers a contiguous range.
+// Planes have no bounds and stay in a linear list at the front of the reordered
+// primitives. The device side is support/kernels/ray_bvh.cl.
+
+// Primitive::type values, as in ray.cl
+#define BASE_RAY_SPHERE 1
+#define BASE_RAY_PLANE 2
+
+struct BaseBvhNode
+{
+  cl_float lo[3];
+  // leaf: first primitive, inner: left child (right child is left + 1)
+  cl_int left_first;
+  cl_float hi[3];
+  // primitives in the leaf, 0 for inner nodes
+  cl_int count;
+};
+
+struct BaseBvh
+{
+  // planes [0, n_planes), then spheres in leaf order
+  base_vector<Primitive> prims;
+  base_vector<BaseBvhNode> nodes;
+  // light primitives, padded to one entry so the buffer is never empty
+  base_vector<cl_int> lights;
+  cl_int n_lights = 0;
+  cl_int n_planes = 0;
+  size_t leaves = 0;
+  size_t max_depth = 0;
+
+  static const size_t bins = 16;
+  static const size_t max_leaf = 4;
+  // primitives a node may keep before it is split
+  size_t leaf_size = max_leaf;
+
+  // leaf at least n keeps every sphere in the root, so traversal tests them all
+  void
+  build(const Primitive* list, size_t n, size_t leaf = max_leaf)
+  {
+    leaf_size = leaf;
+    prims.clear();
+    nodes.clear();
+    lights.clear();
+    leaves = 0;
+    max_depth = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+      if (list[i].type != BASE_RAY_SPHERE) {
+        prims.push_back(list[i]);
+      }
+    }
+    n_planes = prims.size();
+    for (size_t i = 0; i < n; ++i) {
+      if (list[i].type == BASE_RAY_SPHERE) {
+        prims.push_back(list[i]);
+      }
+    }
+
+    nodes.reserve(2 * (prims.size() - n_planes) + 1);
+    nodes.push_back(BaseBvhNode());
+    nodes[0].left_first = n_planes;
+    nodes[0].count = prims.size() - n_planes;
+    bounds(nodes[0]);
+    subdivide(0, 1);
+
+    for (size_t i = 0; i < prims.size(); ++i) {
+      if (prims[i].is_light) {
+        lights.push_back(i);
+      }
+    }
+    n_lights = lights.size();
+    if (lights.empty()) {
+      lights.push_back(0);
+    }
+  }
+
+  void
+  bounds(BaseBvhNode& node) const
+  {
+    for (int a = 0; a < 3; ++a) {
+      node.lo[a] = node.count ? 1e30f : 0.0f;
+      node.hi[a] = node.count ? -1e30f : 0.0f;
+    }
+    for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+      auto& p = prims[i];
+      for (int a = 0; a < 3; ++a) {
+        node.lo[a] = min(node.lo[a], p.center[a] - p.radius);
+        node.hi[a] = max(node.hi[a], p.center[a] + p.radius);
+      }
+    }
+  }
+
+  static float
+  area(const float* lo, const float* hi)
+  {
+    float e[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+    return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+  }
+
+  void
+  subdivide(size_t index, size_t depth)
+  {
+    max_depth = max(max_depth, depth);
+    auto first = nodes[index].left_first;
+    auto count = nodes[index].count;
+    if ((size_t)count <= leaf_size) {
+      leaves++;
+      return;
+    }
+
+    // binned SAH over the centroid bounds
+    float clo[3] = { 1e30f, 1e30f, 1e30f };
+    float chi[3] = { -1e30f, -1e30f, -1e30f };
+    for (int i = first; i < first + count; ++i) {
+      for (int a = 0; a < 3; ++a) {
+        clo[a] = min(clo[a], prims[i].center[a]);
+        chi[a] = max(chi[a], prims[i].center[a]);
+      }
+    }
+
+    auto best_cost = (float)count * area(nodes[index].lo, nodes[index].hi);
+    int best_axis = -1;
+    float best_split = 0.0f;
+    for (int a = 0; a < 3; ++a) {
+      if (chi[a] <= clo[a]) {
+        continue;
+      }
+      auto scale = bins / (chi[a] - clo[a]);
+      size_t bin_count[bins] = {};
+      float bin_lo[bins][3];
+      float bin_hi[bins][3];
+      for (size_t b = 0; b < bins; ++b) {
+        for (int k = 0; k < 3; ++k) {
+          bin_lo[b][k] = 1e30f;
+          bin_hi[b][k] = -1e30f;
+        }
+      }
+      for (int i = first; i < first + count; ++i) {
+        auto& p = prims[i];
+        auto b = min(bins - 1, (size_t)((p.center[a] - clo[a]) * scale));
+        bin_count[b]++;
+        for (int k = 0; k < 3; ++k) {
+          bin_lo[b][k] = min(bin_lo[b][k], p.center[k] - p.radius);
+          bin_hi[b][k] = max(bin_hi[b][k], p.center[k] + p.radius);
+        }
+      }
+
+      // left-to-right and right-to-left sweeps of the bin bounds
+      float left_area[bins - 1];
+      float right_area[bins - 1];
+      size_t left_count[bins - 1];
+      size_t right_count[bins - 1];
+      float llo[3] = { 1e30f, 1e30f, 1e30f }, lhi[3] = { -1e30f, -1e30f, -1e30f };
+      float rlo[3] = { 1e30f, 1e30f, 1e30f }, rhi[3] = { -1e30f, -1e30f, -1e30f };
+      size_t lsum = 0;
+      size_t rsum = 0;
+      for (size_t b = 0; b < bins - 1; ++b) {
+        lsum += bin_count[b];
+        rsum += bin_count[bins - 1 - b];
+        for (int k = 0; k < 3; ++k) {
+          llo[k] = min(llo[k], bin_lo[b][k]);
+          lhi[k] = max(lhi[k], bin_hi[b][k]);
+          rlo[k] = min(rlo[k], bin_lo[bins - 1 - b][k]);
+          rhi[k] = max(rhi[k], bin_hi[bins - 1 - b][k]);
+        }
+        left_count[b] = lsum;
+        left_area[b] = lsum ? area(llo, lhi) : 0.0f;
+        right_count[bins - 2 - b] = rsum;
+        right_area[bins - 2 - b] = rsum ? area(rlo, rhi) : 0.0f;
+      }
+      for (size_t b = 0; b < bins - 1; ++b) {
+        auto cost = left_count[b] * left_area[b] + right_count[b] * right_area[b];
+        if (left_count[b] && right_count[b] && cost < best_cost) {
+          best_cost = cost;
+          best_axis = a;
+          best_split = clo[a] + (b + 1) / scale;
+        }
+      }
+    }
+
+    if (best_axis < 0) {
+      leaves++;
+      return;
+    }
+
+    auto mid = partition(prims.begin() + first,
+                         prims.begin() + first + count,
+                         [&](const Primitive& p) { return p.center[best_axis] < best_split; });
+    int left_count = mid - (prims.begin() + first);
+    if (left_count == 0 || left_count == count) {
+      leaves++;
+      return;
+    }
+
+    int left = nodes.size();
+    nodes.push_back(BaseBvhNode());
+    nodes.push_back(BaseBvhNode());
+    nodes[left].left_first = first;
+    nodes[left].count = left_count;
+    nodes[left + 1].left_first = first + left_count;
+    nodes[left + 1].count = count - left_count;
+    bounds(nodes[left]);
+    bounds(nodes[left + 1]);
+    nodes[index].left_first = left;
+    nodes[index].count = 0;
+
+    subdivide(left, depth + 1);
+    subdivide(left + 1, depth + 1);
+  }
+};
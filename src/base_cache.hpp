@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// On-disk cache of CL_PROGRAM_BINARIES.
+//
+// Entries are named after a hash of the key (kernel source, device name,
+// driver version and build options). The full key is also stored in the entry
+// header and compared on load, so hash collisions and entries written by a
+// different driver are treated as misses and overwritten.
+
+struct BaseBinaryCache
+{
+  string dir;
+
+  bool
+  enabled() const
+  {
+    return !dir.empty();
+  }
+
+  static uint64_t
+  hash(const string& str)
+  {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (auto c : str) {
+      h ^= (unsigned char)c;
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  static string
+  key(const string& source_str,
+      const string& device_name,
+      const string& driver_version,
+      const string& options)
+  {
+    stringstream ss;
+    ss << "source:" << hex << hash(source_str) << dec << ":" << source_str.size() << "\n"
+       << "device:" << device_name << "\n"
+       << "driver:" << driver_version << "\n"
+       << "options:" << options << "\n";
+    return ss.str();
+  }
+
+  string
+  path(const string& name, const string& key) const
+  {
+    stringstream ss;
+    ss << dir << "/" << name << "-" << hex << hash(key) << ".bin";
+    return ss.str();
+  }
+
+  bool
+  load(const string& name, const string& key, vector<char>& binary) const
+  {
+    ifstream f(path(name, key), ios::binary);
+    if (!f) {
+      return false;
+    }
+
+    string magic;
+    uint64_t key_size = 0;
+    uint64_t binary_size = 0;
+    getline(f, magic);
+    f.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+    f.read(reinterpret_cast<char*>(&binary_size), sizeof(binary_size));
+    if (!f || magic != "ECLBIN1" || key_size != key.size() || binary_size == 0) {
+      return false;
+    }
+
+    string stored_key(key_size, '\0');
+    f.read(&stored_key[0], key_size);
+    if (!f || stored_key != key) {
+      return false;
+    }
+
+    binary.resize(binary_size);
+    f.read(binary.data(), binary_size);
+    return (bool)f && f.peek() == EOF;
+  }
+
+  void
+  store(const string& name, const string& key, const vector<char>& binary) const
+  {
+    auto final_path = path(name, key);
+    // write to a private file first so readers never see a partial entry
+    auto tmp_path = final_path + "." + to_string(getpid()) + ".tmp";
+    {
+      ofstream f(tmp_path, ios::binary | ios::trunc);
+      if (!f) {
+        IF_LOGGING(cout << "binary cache: cannot write " << tmp_path << "\n");
+        return;
+      }
+      uint64_t key_size = key.size();
+      uint64_t binary_size = binary.size();
+      f << "ECLBIN1\n";
+      f.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+      f.write(reinterpret_cast<const char*>(&binary_size), sizeof(binary_size));
+      f.write(key.data(), key.size());
+      f.write(binary.data(), binary.size());
+      if (!f) {
+        remove(tmp_path.c_str());
+        return;
+      }
+    }
+    if (rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+      remove(tmp_path.c_str());
+    }
+  }
+
+  void
+  evict(const string& name, const string& key) const
+  {
+    remove(path(name, key).c_str());
+  }
+};
+
+// Binary of a built program for its single device, empty if unavailable.
+inline vector<char>
+base_program_binary(const cl::Program& program)
+{
+  size_t binary_size = 0;
+  cl_int cl_err =
+    clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binary_size, nullptr);
+  if (cl_err != CL_SUCCESS || binary_size == 0) {
+    return {};
+  }
+
+  vector<char> binary(binary_size);
+  auto binary_ptr = reinterpret_cast<unsigned char*>(binary.data());
+  cl_err =
+    clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binary_ptr), &binary_ptr, nullptr);
+  if (cl_err != CL_SUCCESS) {
+    return {};
+  }
+  return binary;
+}
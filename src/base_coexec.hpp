@@ -0,0 +1,330 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base_buffer.hpp"
+#include "base_tune.hpp"
+
+// Co-execution of one NDRange over every device of a session.
+//
+// The global range is split into packages of lws multiples:
+//
+//   tscheduler 0  static, one package per device sized by the props proportions
+//   tscheduler 1  dynamic, chunksize packages handed out on demand
+//   tscheduler 2  hguided, packages shrinking with the remaining work, by props
+//
+// Each device runs on its own host thread: setup(unit, index) creates its
+// buffers, uploads the inputs and sets the kernel args, then every package is
+// launched at its global offset and collect(unit, launch, offset, size) reads
+// that package's slice of the outputs into the host arrays. Without global work
+// offsets the offset is passed as the trailing kernel argument instead.
+//
+// The transfers go through BaseLaunch, see there for the overlap mode.
+//
+// With a single device the whole range is one package on the calling thread,
+// the same launch and readback the benchmarks always did. Its local size goes
+// through base_tuned_lws() when tune_name is set.
+
+// In overlap mode (BaseSession::overlap) buffer i is uploaded and read on
+// transfer queue 1 + i of its unit, so independent transfers overlap each other
+// and the host work that follows (program build, args). The uploads gather in
+// ready until sync() puts a barrier on them into the unit's queue; reads wait
+// for launched and only wait_reads() blocks. Otherwise everything goes through
+// the unit's queue in order, as before.
+struct BaseLaunch
+{
+  cl::Kernel kernel;
+  vector<BaseBuffer> buffers;
+  // device-only buffers (no host copy) the kernel arguments refer to
+  vector<cl::Buffer> scratch;
+  // trailing offset argument, used when ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED is 0
+  cl_uint offset_arg = 0;
+
+  vector<cl::Event> ready;
+  cl::Event launched;
+  vector<cl::Event> reads;
+
+  cl_int
+  upload(BaseSession& unit, size_t i)
+  {
+    if (!unit.overlap) {
+      return buffers[i].upload(unit.queue);
+    }
+    auto& queue = unit.queue_at(1 + i);
+    auto cl_err = buffers[i].upload(queue, &ready);
+    queue.flush();
+    return cl_err;
+  }
+
+  // before the first command on the unit's queue that reads the uploads
+  cl_int
+  sync(BaseSession& unit)
+  {
+    if (ready.empty()) {
+      return CL_SUCCESS;
+    }
+    auto cl_err = unit.queue.enqueueBarrierWithWaitList(&ready);
+    ready.clear();
+    return cl_err;
+  }
+
+  cl_int
+  download(BaseSession& unit, size_t i, size_t offset, size_t size)
+  {
+    if (!unit.overlap) {
+      return buffers[i].download(unit.queue, offset, size);
+    }
+    vector<cl::Event> wait = { launched };
+    auto& queue = unit.queue_at(1 + i);
+    auto cl_err = buffers[i].download(queue, offset, size, &wait, &reads);
+    queue.flush();
+    return cl_err;
+  }
+
+  cl_int
+  wait_reads()
+  {
+    if (reads.empty()) {
+      return CL_SUCCESS;
+    }
+    auto cl_err = cl::Event::waitForEvents(reads);
+    reads.clear();
+    return cl_err;
+  }
+};
+
+struct BaseCoexecDevice
+{
+  size_t packages = 0;
+  size_t items = 0;
+  int64_t busy_ns = 0;
+  int64_t finish_ns = 0;
+};
+
+struct BaseCoexec
+{
+  typedef std::chrono::steady_clock clock;
+
+  BaseSession& session;
+  int tscheduler;
+  size_t chunksize;
+  vector<float> props;
+  // benchmark name for the tuning database, empty keeps lws
+  string tune_name;
+
+  vector<BaseCoexecDevice> devices;
+
+  mutex package_lock;
+  size_t next_offset = 0;
+  vector<pair<size_t, size_t>> static_ranges;
+
+  BaseCoexec(BaseSession& session, int tscheduler, int chunksize, const vector<float>& props)
+    : session(session)
+    , tscheduler(tscheduler)
+    , chunksize(chunksize > 0 ? chunksize : 0)
+    , props(props)
+  {}
+
+  template<class Setup, class Collect>
+  void
+  run(size_t gws, size_t lws, Setup setup, Collect collect)
+  {
+    auto units = session.units();
+    devices.assign(units.size(), BaseCoexecDevice());
+
+    if (units.size() == 1) {
+      auto launch = setup(*units[0], 0);
+      CL_CHECK_ERROR(launch.sync(*units[0]), "barrier");
+      if (!tune_name.empty()) {
+        lws = base_tuned_lws(*units[0], tune_name, launch.kernel, gws, lws);
+      }
+      run_package(*units[0], launch, 0, gws, lws, false, collect, devices[0]);
+      return;
+    }
+
+    plan(units.size(), gws, lws);
+
+    auto time_init = clock::now();
+    vector<thread> threads;
+    vector<exception_ptr> errors(units.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        try {
+          auto& unit = *units[i];
+          if (i) {
+            unit.timer.start();
+          }
+          auto launch = setup(unit, i);
+          CL_CHECK_ERROR(launch.sync(unit), "barrier");
+          size_t offset = 0;
+          size_t size = 0;
+          while (next_package(i, gws, lws, offset, size)) {
+            run_package(unit, launch, offset, size, lws, true, collect, devices[i]);
+          }
+          devices[i].finish_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+        } catch (...) {
+          errors[i] = current_exception();
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    session.timer.mark("read");
+
+    for (auto& error : errors) {
+      if (error) {
+        rethrow_exception(error);
+      }
+    }
+
+    print(units);
+  }
+
+  template<class Collect>
+  void
+  run_package(BaseSession& unit,
+              BaseLaunch& launch,
+              size_t offset,
+              size_t size,
+              size_t lws,
+              bool coexec,
+              Collect collect,
+              BaseCoexecDevice& device)
+  {
+    auto time_init = clock::now();
+
+    auto global_offset = offset;
+    if (coexec && !ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED) {
+      cl_uint offset_value = offset;
+      cl_int cl_err = launch.kernel.setArg(launch.offset_arg, offset_value);
+      CL_CHECK_ERROR(cl_err, "kernel arg offset");
+      global_offset = 0;
+    }
+
+    auto launched = unit.overlap ? &launch.launched : unit.event("kernel", unit.queue);
+    cl_int cl_err = unit.queue.enqueueNDRangeKernel(launch.kernel,
+                                                    cl::NDRange(global_offset),
+                                                    cl::NDRange(size),
+                                                    cl::NDRange(lws),
+                                                    NULL,
+                                                    launched);
+    CL_CHECK_ERROR(cl_err, "enqueue kernel");
+    if (unit.overlap) {
+      // the reads wait for it from the transfer queues
+      unit.traced("kernel", unit.queue, launch.launched);
+      unit.queue.flush();
+    }
+    unit.timer.mark("launch");
+
+    cl_err = collect(unit, launch, offset, size);
+    CL_CHECK_ERROR(cl_err, "read buffer");
+    cl_err = launch.wait_reads();
+    CL_CHECK_ERROR(cl_err, "read buffer");
+    unit.timer.mark("read");
+
+    device.packages++;
+    device.items += size;
+    device.busy_ns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+  }
+
+  // device weights from props, equal shares when props does not cover every device
+  vector<double>
+  weights(size_t ndevices) const
+  {
+    vector<double> w(ndevices, 1.0 / ndevices);
+    if (props.size() >= ndevices) {
+      double sum = 0.0;
+      for (size_t i = 0; i < ndevices; ++i) {
+        sum += max(props[i], 0.0f);
+      }
+      if (sum > 0.0) {
+        for (size_t i = 0; i < ndevices; ++i) {
+          w[i] = max(props[i], 0.0f) / sum;
+        }
+      }
+    }
+    return w;
+  }
+
+  void
+  plan(size_t ndevices, size_t gws, size_t lws)
+  {
+    next_offset = 0;
+    static_ranges.clear();
+    if (tscheduler != 0) {
+      return;
+    }
+
+    auto w = weights(ndevices);
+    size_t begin = 0;
+    double acc = 0.0;
+    for (size_t i = 0; i < ndevices; ++i) {
+      acc += w[i];
+      size_t end = (i == ndevices - 1) ? gws : min(gws, (size_t)(acc * gws) / lws * lws);
+      end = max(end, begin);
+      static_ranges.push_back({ begin, end - begin });
+      begin = end;
+    }
+  }
+
+  bool
+  next_package(size_t index, size_t gws, size_t lws, size_t& offset, size_t& size)
+  {
+    lock_guard<mutex> guard(package_lock);
+
+    if (tscheduler == 0) {
+      if (static_ranges[index].second == 0) {
+        return false;
+      }
+      offset = static_ranges[index].first;
+      size = static_ranges[index].second;
+      static_ranges[index].second = 0;
+      return true;
+    }
+
+    if (next_offset >= gws) {
+      return false;
+    }
+    auto remaining = gws - next_offset;
+    auto ndevices = devices.size();
+
+    // smallest package: chunksize, or an eighth of a fair share if not given
+    size_t package = chunksize ? chunksize : gws / (ndevices * 8);
+    if (tscheduler == 2) {
+      auto w = weights(ndevices);
+      package = max(package, (size_t)(remaining * w[index] / 2.0));
+    }
+    package = max((package + lws - 1) / lws * lws, lws);
+
+    offset = next_offset;
+    size = min(package, remaining);
+    next_offset += size;
+    return true;
+  }
+
+  void
+  print(const vector<BaseSession*>& units) const
+  {
+    int64_t min_finish = devices[0].finish_ns;
+    int64_t max_finish = devices[0].finish_ns;
+    for (size_t i = 0; i < devices.size(); ++i) {
+      auto& d = devices[i];
+      min_finish = min(min_finish, d.finish_ns);
+      max_finish = max(max_finish, d.finish_ns);
+      cout << "coexec device " << i << " (" << units[i]->device_info(CL_DEVICE_NAME)
+           << "): packages " << d.packages << " items " << d.items << " busy "
+           << d.busy_ns / 1000 << " us finish " << d.finish_ns / 1000 << " us\n";
+    }
+    // 0 when every device finishes together
+    auto imbalance = max_finish ? 1.0 - (double)min_finish / max_finish : 0.0;
+    cout << "coexec imbalance: " << imbalance << "\n";
+  }
+};
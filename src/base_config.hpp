@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Run options for the do_*_base benchmarks.
+//
+// The benchmark signatures are fixed by their callers, so optional modes are
+// read from ECL_BASE_* environment variables when a session is created. A
+// caller holding a BaseSession can also set them directly.
+
+inline string
+base_env(const char* name, const string& fallback = "")
+{
+  auto value = getenv(name);
+  return value ? string(value) : fallback;
+}
+
+inline long
+base_env_int(const char* name, long fallback)
+{
+  auto value = getenv(name);
+  return value && *value ? strtol(value, nullptr, 10) : fallback;
+}
+
+struct BaseConfig
+{
+  // directory of the program binary cache, empty disables it
+  string cache_dir;
+
+  // untimed runs before the measured ones, and number of measured runs
+  long warmup = 0;
+  long iterations = 1;
+
+  // copy, use_host_ptr or alloc_host_ptr (see BaseBuffer)
+  string buffer_strategy = "copy";
+
+  // "platform:device,..." devices to co-execute on, empty uses set_cunits
+  string devices;
+
+  // nbody time steps per run, read back every nbody_snapshot steps (0: last
+  // step only), verified at nbody_check_step (0: last step)
+  long nbody_steps = 1;
+  long nbody_snapshot = 0;
+  long nbody_check_step = 0;
+
+  // "x,y" center of a perturbation deep zoom (any number of digits) and its
+  // magnification over the 4-wide view, empty center keeps the float kernel
+  string mandelbrot_center;
+  double mandelbrot_zoom = 1.0;
+
+  // binomial streaming: cl_float4 items per chunk (0 disables) and device
+  // buffer slots cycling through upload, compute and download
+  long binomial_chunk = 0;
+  long binomial_slots = 3;
+
+  // binomial lattice steps, and "local" (one work-group of steps + 1 items
+  // per option vector), "blocked" (lattice in global memory) or "auto"
+  // (local up to the legacy 254 steps)
+  long binomial_steps = 254;
+  string binomial_kernel = "auto";
+
+  // gaussian: "2d" or "separable" filter, and rows per band streamed through
+  // the device with filter_width/2 halo rows (0: whole image)
+  string gaussian_mode = "2d";
+  long gaussian_band = 0;
+
+  // ray: "list" (every primitive from local memory) or "bvh"
+  string ray_accel = "list";
+
+  // ray animation: "x,y,z;x,y,z;..." camera keyframes, and frames rendered
+  // along them (0: one per keyframe)
+  string ray_path;
+  long ray_frames = 0;
+
+  // host threads of the verifiers (0: one per hardware thread)
+  long verify_threads = 0;
+
+  // random elements checked per output (0: all) and their seed
+  long verify_sample = 0;
+  long verify_seed = 0;
+
+  // local work-size autotuning: sweep the legal sizes when the tuning
+  // database (a text file, empty: none) has no entry (see base_tune.hpp)
+  long tune = 0;
+  string tune_db;
+
+  // do_sweep: "bench:sizes;..." with sizes "a,b", "a-b*factor" or "a-b+step",
+  // the tdevices values to run them on ("native" for the host backend), and
+  // the .csv or .json file of the results (empty: stdout only)
+  string sweep;
+  string sweep_devices = "0";
+  string sweep_out;
+
+  // interleaved run pairs per do_*_diff comparison (see base_diff.hpp)
+  long diff_runs = 20;
+
+  // transfers: 0 in order on one queue, 1 overlapped on a queue per buffer,
+  // 2 alternating between both over the iterations to measure the gain
+  long overlap = 0;
+
+  // CL_QUEUE_PROFILING_ENABLE and a per-command device time summary; a
+  // trace path also writes the Chrome/Perfetto timeline of the last run
+  long profile = 0;
+  string trace;
+
+  // input generator: "rand" (the serial harness rand()) or "philox"
+  // (counter-based, parallel, reproducible from input_seed)
+  string input = "rand";
+  long input_seed = 0;
+
+  // check == 2 images: wait for the background writer before returning
+  long image_wait = 0;
+
+  // host threads of the do_*_native backend (0: one per hardware thread)
+  long native_threads = 0;
+
+  static BaseConfig
+  from_env()
+  {
+    BaseConfig config;
+    config.cache_dir = base_env("ECL_BASE_CACHE_DIR");
+    config.warmup = max(base_env_int("ECL_BASE_WARMUP", 0), 0L);
+    config.iterations = max(base_env_int("ECL_BASE_ITERATIONS", 1), 1L);
+    config.buffer_strategy = base_env("ECL_BASE_BUFFERS", "copy");
+    config.devices = base_env("ECL_BASE_DEVICES");
+    config.nbody_steps = max(base_env_int("ECL_BASE_NBODY_STEPS", 1), 1L);
+    config.nbody_snapshot = max(base_env_int("ECL_BASE_NBODY_SNAPSHOT", 0), 0L);
+    config.nbody_check_step = max(base_env_int("ECL_BASE_NBODY_CHECK_STEP", 0), 0L);
+    config.mandelbrot_center = base_env("ECL_BASE_MANDELBROT_CENTER");
+    config.mandelbrot_zoom = stod(base_env("ECL_BASE_MANDELBROT_ZOOM", "1"));
+    config.binomial_chunk = max(base_env_int("ECL_BASE_BINOMIAL_CHUNK", 0), 0L);
+    config.binomial_slots = max(base_env_int("ECL_BASE_BINOMIAL_SLOTS", 3), 2L);
+    config.binomial_steps = max(base_env_int("ECL_BASE_BINOMIAL_STEPS", 254), 1L);
+    config.binomial_kernel = base_env("ECL_BASE_BINOMIAL_KERNEL", "auto");
+    config.gaussian_mode = base_env("ECL_BASE_GAUSSIAN_MODE", "2d");
+    config.gaussian_band = max(base_env_int("ECL_BASE_GAUSSIAN_BAND", 0), 0L);
+    config.ray_accel = base_env("ECL_BASE_RAY_ACCEL", "list");
+    config.ray_path = base_env("ECL_BASE_RAY_PATH");
+    config.ray_frames = max(base_env_int("ECL_BASE_RAY_FRAMES", 0), 0L);
+    config.verify_threads = max(base_env_int("ECL_BASE_VERIFY_THREADS", 0), 0L);
+    config.verify_sample = max(base_env_int("ECL_BASE_VERIFY_SAMPLE", 0), 0L);
+    config.verify_seed = base_env_int("ECL_BASE_VERIFY_SEED", 0);
+    config.tune = max(base_env_int("ECL_BASE_TUNE", 0), 0L);
+    config.tune_db = base_env("ECL_BASE_TUNE_DB");
+    config.sweep = base_env("ECL_BASE_SWEEP");
+    config.sweep_devices = base_env("ECL_BASE_SWEEP_DEVICES", "0");
+    config.sweep_out = base_env("ECL_BASE_SWEEP_OUT");
+    config.diff_runs = max(base_env_int("ECL_BASE_DIFF_RUNS", 20), 2L);
+    config.overlap = max(base_env_int("ECL_BASE_OVERLAP", 0), 0L);
+    config.profile = base_env_int("ECL_BASE_PROFILE", 0);
+    config.trace = base_env("ECL_BASE_TRACE");
+    config.input = base_env("ECL_BASE_INPUT", "rand");
+    config.input_seed = base_env_int("ECL_BASE_INPUT_SEED", 0);
+    config.image_wait = max(base_env_int("ECL_BASE_IMAGE_WAIT", 0), 0L);
+    config.native_threads = max(base_env_int("ECL_BASE_NATIVE_THREADS", 0), 0L);
+    return config;
+  }
+};
+
+// Parses "platform:device,platform:device" into index pairs.
+inline vector<pair<uint, uint>>
+base_parse_devices(const string& devices)
+{
+  vector<pair<uint, uint>> list;
+  stringstream ss(devices);
+  string item;
+  while (getline(ss, item, ',')) {
+    auto colon = item.find(':');
+    if (colon == string::npos) {
+      throw runtime_error("invalid device entry (expected platform:device): " + item);
+    }
+    list.push_back({ (uint)stoul(item.substr(0, colon)), (uint)stoul(item.substr(colon + 1)) });
+  }
+  return list;
+}
+
+// Parses "x,y,z;x,y,z" into camera positions.
+inline vector<vector<float>>
+base_parse_path(const string& path)
+{
+  vector<vector<float>> list;
+  stringstream ss(path);
+  string item;
+  while (getline(ss, item, ';')) {
+    vector<float> point;
+    stringstream coords(item);
+    string coord;
+    while (getline(coords, coord, ',')) {
+      point.push_back(stof(coord));
+    }
+    if (point.size() != 3) {
+      throw runtime_error("invalid camera path entry (expected x,y,z): " + item);
+    }
+    list.push_back(point);
+  }
+  return list;
+}
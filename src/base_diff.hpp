@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "base_config.hpp"
+#include "base_stats.hpp"
+
+// Differential overhead of ecl::Program against the do_*_base baselines.
+//
+// base_diff() calls both sides config.diff_runs times each, interleaved and
+// alternating which goes first so drift (clocks, thermals, caches) hits both
+// alike, after one discarded pair. rand() is reseeded before every call so
+// both see the same inputs. Each call is timed whole on the steady clock. The
+// callers (diff.cpp) make both sides one plain unchecked run: the base side
+// on a default BaseConfig, so ECL_BASE_* warmup, iterations and modes do not
+// apply to it. Only then is the difference of the means the library's
+// overhead; Welch's t-test tells whether it is distinguishable from noise.
+
+// one whole call in ns
+template<class F>
+int64_t
+base_diff_time(F& run)
+{
+  typedef std::chrono::steady_clock clock;
+  srand(0);
+  auto time_init = clock::now();
+  run();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+}
+
+template<class Base, class Ecl>
+BaseWelch
+base_diff(const string& bench, const BaseConfig& config, Base run_base, Ecl run_ecl)
+{
+
+  BaseStats base_stats;
+  BaseStats ecl_stats;
+  for (long run = -1; run < config.diff_runs; ++run) {
+    int64_t base_ns;
+    int64_t ecl_ns;
+    if (run % 2 == 0) {
+      base_ns = base_diff_time(run_base);
+      ecl_ns = base_diff_time(run_ecl);
+    } else {
+      ecl_ns = base_diff_time(run_ecl);
+      base_ns = base_diff_time(run_base);
+    }
+    if (run >= 0) {
+      base_stats.add(base_ns);
+      ecl_stats.add(ecl_ns);
+    }
+  }
+
+  auto w = base_welch(base_stats, ecl_stats);
+  auto base_mean = base_stats.mean();
+  auto relative = base_mean > 0 ? w.diff / base_mean * 100.0 : 0.0;
+  auto significant = w.p < 0.05;
+
+  auto us = [](double ns) { return ns / 1000.0; };
+  cout << fixed << setprecision(3);
+  cout << "diff: " << bench << " runs " << config.diff_runs << " base " << us(base_mean)
+       << " us ecl " << us(ecl_stats.mean()) << " us overhead " << us(w.diff) << " us ("
+       << relative << "%) ci95 [" << us(w.diff - w.ci95) << ", " << us(w.diff + w.ci95)
+       << "] t " << w.t << " df " << w.df << " p " << w.p
+       << (significant ? " significant" : " not significant") << "\n";
+  cout.unsetf(ios::floatfield);
+  cout << setprecision(6);
+
+  stringstream ss;
+  ss << fixed << setprecision(0) << "{\"bench\":\"" << bench << "\",\"runs\":" << config.diff_runs
+     << ",\"base_mean_ns\":" << base_mean << ",\"base_median_ns\":" << base_stats.median()
+     << ",\"ecl_mean_ns\":" << ecl_stats.mean() << ",\"ecl_median_ns\":" << ecl_stats.median()
+     << ",\"overhead_ns\":" << w.diff << ",\"ci95_ns\":[" << w.diff - w.ci95 << ","
+     << w.diff + w.ci95 << "]" << setprecision(6) << ",\"overhead_rel\":" << relative / 100.0
+     << ",\"t\":" << w.t << ",\"df\":" << w.df << ",\"p\":" << w.p << "}";
+  cout << "diff: " << ss.str() << "\n";
+  return w;
+}
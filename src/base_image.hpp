@@ -0,0 +1,239 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "base_config.hpp"
+
+// Background BMP output for check == 2.
+//
+// base_image_writer() owns one writer thread for the process. submit() hands
+// it a finished image, keeping the pixel buffer alive through owner, and
+// returns a future that completes once the file is closed, so the benchmark
+// returns while the image is encoded and written. The 24-bit BMP is produced
+// in bands of rows: each band is converted to BGR into a buffer of about
+// band_bytes and written with a single write() call. Encoding (including the
+// job's prepare step) and writing are timed apart and printed per image.
+// Pending images are flushed when the process exits.
+
+struct BaseImageResult
+{
+  string path;
+  size_t bytes = 0;
+  int64_t encode_ns = 0;
+  int64_t write_ns = 0;
+  string error;
+};
+
+struct BaseImageJob
+{
+  string path;
+  int width = 0;
+  int height = 0;
+  // RGBA rows, top row first
+  const cl_uchar4* pixels = nullptr;
+  shared_ptr<void> owner;
+  // runs on the writer thread before encoding (e.g. transform_image)
+  function<void()> prepare;
+  promise<BaseImageResult> done;
+};
+
+struct BaseImageWriter
+{
+  typedef std::chrono::steady_clock clock;
+
+  static const size_t band_bytes = 4 << 20;
+
+  mutex lock;
+  condition_variable wake;
+  deque<unique_ptr<BaseImageJob>> jobs;
+  bool stopping = false;
+  thread worker;
+
+  BaseImageWriter()
+    : worker([this]() { loop(); })
+  {}
+
+  ~BaseImageWriter()
+  {
+    {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+  }
+
+  shared_future<BaseImageResult>
+  submit(const string& path,
+         int width,
+         int height,
+         const cl_uchar4* pixels,
+         shared_ptr<void> owner,
+         function<void()> prepare = nullptr)
+  {
+    unique_ptr<BaseImageJob> job(new BaseImageJob());
+    job->path = path;
+    job->width = width;
+    job->height = height;
+    job->pixels = pixels;
+    job->owner = move(owner);
+    job->prepare = move(prepare);
+    shared_future<BaseImageResult> result = job->done.get_future().share();
+    {
+      lock_guard<mutex> guard(lock);
+      jobs.push_back(move(job));
+    }
+    wake.notify_one();
+    return result;
+  }
+
+  void
+  loop()
+  {
+    for (;;) {
+      unique_ptr<BaseImageJob> job;
+      {
+        unique_lock<mutex> guard(lock);
+        wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty()) {
+          return;
+        }
+        job = move(jobs.front());
+        jobs.pop_front();
+      }
+      auto result = write(*job);
+      stringstream ss;
+      ss << "image: " << result.path << " " << job->width << "x" << job->height;
+      if (result.error.empty()) {
+        ss << " encode " << result.encode_ns / 1000 << " us write " << result.write_ns / 1000
+           << " us " << result.bytes << " B\n";
+      } else {
+        ss << " failed: " << result.error << "\n";
+      }
+      cout << ss.str() << flush;
+      job->owner.reset();
+      job->done.set_value(result);
+    }
+  }
+
+  static void
+  put_le(unsigned char* dst, uint32_t value, int size)
+  {
+    for (int i = 0; i < size; ++i) {
+      dst[i] = (value >> (8 * i)) & 0xff;
+    }
+  }
+
+  static BaseImageResult
+  write(BaseImageJob& job)
+  {
+    BaseImageResult result;
+    result.path = job.path;
+
+    auto time_init = clock::now();
+    if (job.prepare) {
+      job.prepare();
+    }
+
+    size_t row_bytes = ((size_t)job.width * 3 + 3) / 4 * 4;
+    size_t image_bytes = row_bytes * job.height;
+    unsigned char header[54] = { 'B', 'M' };
+    put_le(header + 2, 54 + image_bytes, 4);
+    put_le(header + 10, 54, 4);
+    put_le(header + 14, 40, 4);
+    put_le(header + 18, job.width, 4);
+    put_le(header + 22, job.height, 4);
+    put_le(header + 26, 1, 2);
+    put_le(header + 28, 24, 2);
+    put_le(header + 34, image_bytes, 4);
+
+    int fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      result.error = "cannot open";
+      return result;
+    }
+
+    auto put = [&](const unsigned char* data, size_t size) {
+      auto write_init = clock::now();
+      while (size && result.error.empty()) {
+        auto n = ::write(fd, data, size);
+        if (n <= 0) {
+          result.error = "write failed";
+          break;
+        }
+        data += n;
+        size -= n;
+        result.bytes += n;
+      }
+      result.write_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - write_init).count();
+    };
+
+    put(header, sizeof(header));
+
+    // BMP rows go bottom-up
+    size_t band_rows = max<size_t>(1, band_bytes / row_bytes);
+    vector<unsigned char> band(band_rows * row_bytes, 0);
+    for (int row = job.height - 1; row >= 0 && result.error.empty();) {
+      size_t rows = 0;
+      for (; rows < band_rows && row >= 0; ++rows, --row) {
+        auto src = job.pixels + (size_t)row * job.width;
+        auto dst = band.data() + rows * row_bytes;
+        for (int x = 0; x < job.width; ++x) {
+          dst[3 * x] = src[x].s[2];
+          dst[3 * x + 1] = src[x].s[1];
+          dst[3 * x + 2] = src[x].s[0];
+        }
+      }
+      put(band.data(), rows * row_bytes);
+    }
+    auto close_init = clock::now();
+    close(fd);
+    result.write_ns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - close_init).count();
+
+    auto total_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+    result.encode_ns = total_ns - result.write_ns;
+    return result;
+  }
+};
+
+inline BaseImageWriter&
+base_image_writer()
+{
+  static BaseImageWriter writer;
+  return writer;
+}
+
+// Queues the image and prints its name; with config.image_wait set the file is
+// complete on return.
+inline shared_future<BaseImageResult>
+base_write_image(const BaseConfig& config,
+                 const string& path,
+                 int width,
+                 int height,
+                 const cl_uchar4* pixels,
+                 shared_ptr<void> owner,
+                 function<void()> prepare = nullptr)
+{
+  auto written =
+    base_image_writer().submit(path, width, height, pixels, move(owner), move(prepare));
+  cout << "writing " << path << "\n";
+  if (config.image_wait) {
+    written.wait();
+  }
+  return written;
+}
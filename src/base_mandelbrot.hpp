@@ -0,0 +1,299 @@
+#pragma once
+
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base_buffer.hpp"
+#include "base_verify.hpp"
+
+// Perturbation deep zoom for do_mandelbrot_base.
+//
+// The view center is parsed and iterated in double-double (~32 significant
+// digits) once on the host; the reference orbit Z_n is then stored as float2,
+// since only its magnitude matters to the pixels. Every pixel iterates its
+// delta d_n = z_n - Z_n in float,
+//
+//   d_{n+1} = 2 Z_n d_n + d_n^2 + dc
+//
+// and is rebased (d = Z_n + d_n, n = 0) when |Z_n + d_n| < |d_n| (glitch) or
+// the reference orbit ended, so no separate glitch pass is needed. The device
+// side is support/kernels/mandelbrot_perturb.cl, the native one replays the
+// iteration with double deltas (base_mandelbrot_perturb). Neither is its own
+// check: base_check_mandelbrot_perturb iterates z^2 + c of every checked pixel
+// directly in double-double, without orbit, rebasing or glitch test.
+
+struct BaseDD
+{
+  double hi = 0.0;
+  double lo = 0.0;
+};
+
+inline BaseDD
+base_dd_quick_two_sum(double a, double b)
+{
+  double s = a + b;
+  return { s, b - (s - a) };
+}
+
+inline BaseDD
+base_dd_two_sum(double a, double b)
+{
+  double s = a + b;
+  double bb = s - a;
+  return { s, (a - (s - bb)) + (b - bb) };
+}
+
+inline BaseDD
+base_dd_add(BaseDD a, BaseDD b)
+{
+  auto s = base_dd_two_sum(a.hi, b.hi);
+  s.lo += a.lo + b.lo;
+  return base_dd_quick_two_sum(s.hi, s.lo);
+}
+
+inline BaseDD
+base_dd_sub(BaseDD a, BaseDD b)
+{
+  return base_dd_add(a, { -b.hi, -b.lo });
+}
+
+inline BaseDD
+base_dd_mul(BaseDD a, BaseDD b)
+{
+  double p = a.hi * b.hi;
+  double e = fma(a.hi, b.hi, -p);
+  e += a.hi * b.lo + a.lo * b.hi;
+  return base_dd_quick_two_sum(p, e);
+}
+
+inline BaseDD
+base_dd_div(BaseDD a, BaseDD b)
+{
+  double q1 = a.hi / b.hi;
+  auto r = base_dd_sub(a, base_dd_mul({ q1, 0.0 }, b));
+  double q2 = r.hi / b.hi;
+  r = base_dd_sub(r, base_dd_mul({ q2, 0.0 }, b));
+  double q3 = r.hi / b.hi;
+  return base_dd_add(base_dd_quick_two_sum(q1, q2), { q3, 0.0 });
+}
+
+// Decimal string ("-0.7436438870371587047521915", "1.5e-3") to double-double.
+inline BaseDD
+base_dd_parse(const string& str)
+{
+  size_t i = 0;
+  while (i < str.size() && isspace((unsigned char)str[i])) {
+    ++i;
+  }
+  auto negative = i < str.size() && str[i] == '-';
+  if (i < str.size() && (str[i] == '-' || str[i] == '+')) {
+    ++i;
+  }
+
+  BaseDD mantissa;
+  long exponent = 0;
+  auto digits = 0;
+  auto fraction = false;
+  for (; i < str.size(); ++i) {
+    auto c = str[i];
+    if (c == '.' && !fraction) {
+      fraction = true;
+    } else if (isdigit((unsigned char)c)) {
+      mantissa = base_dd_add(base_dd_mul(mantissa, { 10.0, 0.0 }), { (double)(c - '0'), 0.0 });
+      exponent -= fraction;
+      digits++;
+    } else {
+      break;
+    }
+  }
+  if (i < str.size() && (str[i] == 'e' || str[i] == 'E')) {
+    exponent += stol(str.substr(i + 1));
+    i = str.size();
+  }
+  while (i < str.size() && isspace((unsigned char)str[i])) {
+    ++i;
+  }
+  if (!digits || i != str.size()) {
+    throw runtime_error("invalid decimal number: " + str);
+  }
+
+  BaseDD scale = { 1.0, 0.0 };
+  for (long e = 0; e < labs(exponent); ++e) {
+    scale = base_dd_mul(scale, { 10.0, 0.0 });
+  }
+  auto value = exponent < 0 ? base_dd_div(mantissa, scale) : base_dd_mul(mantissa, scale);
+  return negative ? BaseDD{ -value.hi, -value.lo } : value;
+}
+
+// "x,y" view center in double-double
+inline pair<BaseDD, BaseDD>
+base_mandelbrot_center(const string& center)
+{
+  auto comma = center.find(',');
+  if (comma == string::npos) {
+    throw runtime_error("invalid mandelbrot center (expected x,y): " + center);
+  }
+  return { base_dd_parse(center.substr(0, comma)), base_dd_parse(center.substr(comma + 1)) };
+}
+
+// Z_0 = 0, Z_{n+1} = Z_n^2 + C until escape or max_iterations, escaped point included
+inline base_vector<cl_float2>
+base_mandelbrot_orbit(BaseDD cx, BaseDD cy, uint max_iterations)
+{
+  base_vector<cl_float2> orbit;
+  orbit.reserve(max_iterations + 1);
+  BaseDD zx;
+  BaseDD zy;
+  orbit.push_back({ { 0.0f, 0.0f } });
+  for (uint n = 0; n < max_iterations; ++n) {
+    auto zx2 = base_dd_mul(zx, zx);
+    auto zy2 = base_dd_mul(zy, zy);
+    auto zxy = base_dd_mul(zx, zy);
+    zx = base_dd_add(base_dd_sub(zx2, zy2), cx);
+    zy = base_dd_add(base_dd_add(zxy, zxy), cy);
+    orbit.push_back({ { (float)zx.hi, (float)zy.hi } });
+    if (zx.hi * zx.hi + zy.hi * zy.hi > 4.0) {
+      break;
+    }
+  }
+  return orbit;
+}
+
+// same palette as mandelbrot_perturb.cl
+inline cl_uchar4
+base_mandelbrot_color(uint iter, uint max_iterations)
+{
+  if (iter >= max_iterations) {
+    return { { 0, 0, 0, 255 } };
+  }
+  return { { (unsigned char)(iter * 7 % 256),
+             (unsigned char)(iter * 3 % 256),
+             (unsigned char)(iter * 11 % 256),
+             255 } };
+}
+
+// Escape iteration of pixel delta (dcx, dcy), mirroring the kernel with doubles.
+inline uint
+base_mandelbrot_perturb(const base_vector<cl_float2>& orbit,
+                        double dcx,
+                        double dcy,
+                        uint max_iterations)
+{
+  double dx = 0.0;
+  double dy = 0.0;
+  size_t n = 0;
+  for (uint iter = 0; iter < max_iterations; ++iter) {
+    double rx = orbit[n].s[0];
+    double ry = orbit[n].s[1];
+    double tx = 2.0 * rx + dx;
+    double ty = 2.0 * ry + dy;
+    double ndx = tx * dx - ty * dy + dcx;
+    double ndy = tx * dy + ty * dx + dcy;
+    dx = ndx;
+    dy = ndy;
+    n++;
+    double zx = orbit[n].s[0] + dx;
+    double zy = orbit[n].s[1] + dy;
+    double zn = zx * zx + zy * zy;
+    if (zn > 4.0) {
+      return iter + 1;
+    }
+    if (zn < dx * dx + dy * dy || n == orbit.size() - 1) {
+      dx = zx;
+      dy = zy;
+      n = 0;
+    }
+  }
+  return max_iterations;
+}
+
+// Escape iteration of c = (cx, cy): z_0 = 0, z_{n+1} = z_n^2 + c in double-double.
+inline uint
+base_mandelbrot_direct(BaseDD cx, BaseDD cy, uint max_iterations)
+{
+  BaseDD zx;
+  BaseDD zy;
+  for (uint iter = 0; iter < max_iterations; ++iter) {
+    auto zx2 = base_dd_mul(zx, zx);
+    auto zy2 = base_dd_mul(zy, zy);
+    auto zxy = base_dd_mul(zx, zy);
+    zx = base_dd_add(base_dd_sub(zx2, zy2), cx);
+    zy = base_dd_add(base_dd_add(zxy, zxy), cy);
+    if (zx.hi * zx.hi + zy.hi * zy.hi > 4.0) {
+      return iter + 1;
+    }
+  }
+  return max_iterations;
+}
+
+// Whether pixel (x, y) has the color of the direct iteration at center + dc.
+inline bool
+base_mandelbrot_pixel_ok(const cl_uchar4* out,
+                         BaseDD center_x,
+                         BaseDD center_y,
+                         double dcx0,
+                         double dcy0,
+                         double xstep,
+                         double ystep,
+                         uint max_iterations,
+                         int width,
+                         size_t x,
+                         size_t y)
+{
+  auto cx = base_dd_add(center_x, { dcx0 + x * xstep, 0.0 });
+  auto cy = base_dd_add(center_y, { dcy0 + y * ystep, 0.0 });
+  auto iter = base_mandelbrot_direct(cx, cy, max_iterations);
+  auto expected = base_mandelbrot_color(iter, max_iterations);
+  return memcmp(expected.s, out[y * width + x].s, sizeof(expected.s)) == 0;
+}
+
+// Fraction of mismatching pixels must stay within threshold, the one
+// check_mandelbrot gets: float deltas legitimately disagree with the exact
+// iteration on a few pixels next to the set boundary. Every pixel costs up to
+// max_iterations double-double steps, so large zooms are best sampled
+// (config.verify_sample).
+inline bool
+base_check_mandelbrot_perturb(BaseVerify& verify,
+                              const cl_uchar4* out,
+                              BaseDD center_x,
+                              BaseDD center_y,
+                              double dcx0,
+                              double dcy0,
+                              double xstep,
+                              double ystep,
+                              uint max_iterations,
+                              int width,
+                              int height,
+                              float threshold)
+{
+  size_t pixels = (size_t)width * height;
+  auto pixel_ok = [&](size_t x, size_t y) {
+    return base_mandelbrot_pixel_ok(
+      out, center_x, center_y, dcx0, dcy0, xstep, ystep, max_iterations, width, x, y);
+  };
+
+  if (verify.sampling(pixels)) {
+    auto pos = verify.sampled(
+      pixels, [&](size_t pixel) { return pixel_ok(pixel % width, pixel / width); }, "pixels");
+    if (pos != -1) {
+      cout << "first mismatch: pixel " << pos << "\n";
+    }
+    return verify.estimate_within("perturbation", threshold);
+  }
+
+  auto wrong = verify.mismatches(height, 1, [&](size_t begin, size_t end) {
+    size_t rows_wrong = 0;
+    for (size_t y = begin; y < end; ++y) {
+      for (int x = 0; x < width; ++x) {
+        rows_wrong += !pixel_ok(x, y);
+      }
+    }
+    return rows_wrong;
+  });
+  auto ratio = (double)wrong / pixels;
+  cout << "perturbation mismatches: " << wrong << " (" << ratio << ")\n";
+  return ratio <= threshold;
+}
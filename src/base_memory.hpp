@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+
+// Memory high-water marks of the do_*_base runs.
+//
+// BaseAlignedAllocator (base_vector) adds every allocation to
+// base_host_memory(), whose peak is reset when BaseSession::measure() starts;
+// device buffers are counted per run as the "device_bytes" timer counter.
+// Peak RSS is VmHWM, reset through /proc/self/clear_refs where the kernel
+// allows it, so it covers the harness' own arrays (Gaussian, data_t) too.
+
+struct BaseHostMemory
+{
+  atomic<int64_t> bytes{ 0 };
+  atomic<int64_t> peak{ 0 };
+
+  void
+  add(int64_t n)
+  {
+    auto now = bytes += n;
+    auto old_peak = peak.load();
+    while (now > old_peak && !peak.compare_exchange_weak(old_peak, now)) {
+    }
+  }
+
+  void
+  sub(int64_t n)
+  {
+    bytes -= n;
+  }
+
+  void
+  reset_peak()
+  {
+    peak = bytes.load();
+  }
+};
+
+inline BaseHostMemory&
+base_host_memory()
+{
+  static BaseHostMemory memory;
+  return memory;
+}
+
+// best effort, the peak stays process-wide where this is not supported
+inline void
+base_reset_peak_rss()
+{
+  ofstream f("/proc/self/clear_refs");
+  if (f) {
+    f << "5";
+  }
+}
+
+inline long
+base_peak_rss_kb()
+{
+  ifstream f("/proc/self/status");
+  string line;
+  while (getline(f, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return stol(line.substr(6));
+    }
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    return usage.ru_maxrss;
+  }
+  return 0;
+}
@@ -0,0 +1,587 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base_bvh.hpp"
+#include "base_config.hpp"
+
+// Native CPU backend of the do_*_native benchmarks.
+//
+// The kernels run on host threads: base_native_for() hands out grain-sized
+// blocks of the range from a shared counter, so threads that finish early
+// take more blocks. Inner loops work on fixed-width lane arrays and are
+// compiled once per instruction set with target_clones; the dynamic loader
+// resolves the AVX-512, AVX2 or SSE4.2 clone for the running CPU, which
+// base_native_isa() reports. The math mirrors the OpenCL kernels so the
+// outputs go through the same checks as do_*_base.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BASE_NATIVE_CLONES __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#else
+#define BASE_NATIVE_CLONES
+#endif
+
+// binomial_options constants
+#define BASE_BINOMIAL_RISKFREE 0.02f
+#define BASE_BINOMIAL_VOLATILITY 0.30f
+
+// instruction set of the clones picked at load time
+inline string
+base_native_isa()
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return "avx512f";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return "sse4.2";
+  }
+#endif
+  return "default";
+}
+
+inline size_t
+base_native_threads(const BaseConfig& config)
+{
+  return config.native_threads ? config.native_threads : max(thread::hardware_concurrency(), 1u);
+}
+
+// fn(begin, end) over [0, n) in blocks of grain, the calling thread included
+template<class F>
+void
+base_native_for(size_t threads, size_t n, size_t grain, F fn)
+{
+  grain = max<size_t>(grain, 1);
+  auto blocks = (n + grain - 1) / grain;
+  threads = max<size_t>(1, min(threads, blocks));
+
+  atomic<size_t> next(0);
+  vector<exception_ptr> errors(threads);
+  auto work = [&](size_t t) {
+    try {
+      for (auto block = next++; block < blocks; block = next++) {
+        fn(block * grain, min(n, (block + 1) * grain));
+      }
+    } catch (...) {
+      errors[t] = current_exception();
+    }
+  };
+
+  vector<thread> workers;
+  for (size_t t = 1; t < threads; ++t) {
+    workers.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  for (auto& error : errors) {
+    if (error) {
+      rethrow_exception(error);
+    }
+  }
+}
+
+// Options [begin, end) of the binomial_options lattice, 16 options per lane
+// group: every step of the backward induction is one pass over the tree
+// nodes with the options in the inner loop.
+BASE_NATIVE_CLONES
+inline void
+base_native_binomial(const float* in, float* out, size_t begin, size_t end, uint steps)
+{
+  const size_t lanes = 16;
+  vector<float> call((steps + 1) * lanes);
+  float* __restrict c = call.data();
+
+  for (size_t first = begin; first < end; first += lanes) {
+    auto count = min(lanes, end - first);
+    float s[lanes], x[lanes], vsdt[lanes], pu_r[lanes], pd_r[lanes];
+    for (size_t k = 0; k < lanes; ++k) {
+      auto r = k < count ? in[first + k] : 0.0f;
+      s[k] = (1.0f - r) * 5.0f + r * 30.0f;
+      x[k] = (1.0f - r) * 1.0f + r * 100.0f;
+      auto years = (1.0f - r) * 0.25f + r * 10.0f;
+      auto dt = years * (1.0f / (float)steps);
+      vsdt[k] = BASE_BINOMIAL_VOLATILITY * sqrtf(dt);
+      auto rate = expf(BASE_BINOMIAL_RISKFREE * dt);
+      auto u = expf(vsdt[k]);
+      auto d = 1.0f / u;
+      auto pu = (rate - d) / (u - d);
+      pu_r[k] = pu / rate;
+      pd_r[k] = (1.0f - pu) / rate;
+    }
+
+    for (uint t = 0; t <= steps; ++t) {
+      for (size_t k = 0; k < lanes; ++k) {
+        auto profit = s[k] * expf(vsdt[k] * (2.0f * t - (float)steps)) - x[k];
+        c[t * lanes + k] = profit > 0.0f ? profit : 0.0f;
+      }
+    }
+    // node t of level j only reads nodes t and t + 1 of level j + 1
+    for (uint j = steps; j > 0; --j) {
+      for (uint t = 0; t < j; ++t) {
+        for (size_t k = 0; k < lanes; ++k) {
+          c[t * lanes + k] = pu_r[k] * c[t * lanes + k] + pd_r[k] * c[(t + 1) * lanes + k];
+        }
+      }
+    }
+    for (size_t k = 0; k < count; ++k) {
+      out[first + k] = c[k];
+    }
+  }
+}
+
+// mandelbrot_vector_float palette, or the raw count in bench mode
+inline cl_uchar4
+base_native_mandelbrot_color(uint count, float x, float y, uint max_iterations, int bench)
+{
+  if (bench) {
+    return { { (unsigned char)(count & 0xff),
+               (unsigned char)((count >> 8) & 0xff),
+               (unsigned char)((count >> 16) & 0xff),
+               (unsigned char)((count >> 24) & 0xff) } };
+  }
+  if (count == max_iterations) {
+    return { { 0, 0, 0, 255 } };
+  }
+  auto fc = count + 1 - log2f(log2f(sqrtf(x * x + y * y)));
+  auto c = fc * 2.0f * 3.1416f / 256.0f;
+  return { { (unsigned char)((1.0f + cosf(c)) * 0.5f * 255),
+             (unsigned char)((1.0f + cosf(2.0f * c + 2.0f * 3.1416f / 3.0f)) * 0.5f * 255),
+             (unsigned char)((1.0f + cosf(c - 2.0f * 3.1416f / 3.0f)) * 0.5f * 255),
+             255 } };
+}
+
+// Rows [begin, end) of the image into out (row begin first), 16 pixels of a
+// row iterated together with masked updates until every lane escaped or
+// reached max_iterations.
+BASE_NATIVE_CLONES
+inline void
+base_native_mandelbrot(cl_uchar4* out,
+                       float leftx,
+                       float topy,
+                       float xstep,
+                       float ystep,
+                       uint max_iterations,
+                       int width,
+                       int bench,
+                       size_t begin,
+                       size_t end)
+{
+  const int lanes = 16;
+  for (size_t row = begin; row < end; ++row) {
+    auto y0 = topy + ystep * (float)row;
+    for (int col = 0; col < width; col += lanes) {
+      float x0[lanes], zx[lanes], zy[lanes];
+      uint count[lanes];
+      for (int k = 0; k < lanes; ++k) {
+        x0[k] = leftx + xstep * (float)(col + k);
+        zx[k] = x0[k];
+        zy[k] = y0;
+        count[k] = 0;
+      }
+      for (uint iter = 0; iter < max_iterations; ++iter) {
+        uint active = 0;
+        for (int k = 0; k < lanes; ++k) {
+          auto x2 = zx[k] * zx[k];
+          auto y2 = zy[k] * zy[k];
+          uint stay = x2 + y2 <= 4.0f;
+          auto nx = x2 - y2 + x0[k];
+          auto ny = 2.0f * zx[k] * zy[k] + y0;
+          zx[k] = stay ? nx : zx[k];
+          zy[k] = stay ? ny : zy[k];
+          count[k] += stay;
+          active += stay;
+        }
+        if (!active) {
+          break;
+        }
+      }
+      for (int k = 0; k < min(lanes, width - col); ++k) {
+        out[(row - begin) * width + col + k] =
+          base_native_mandelbrot_color(count[k], zx[k], zy[k], max_iterations, bench);
+      }
+    }
+  }
+}
+
+// Rows [begin, end) of the 2D gaussian_blur with clamped borders. Each input
+// row is widened once to floats padded by the filter radius, so the inner
+// loop over the row has no clamping and vectorizes.
+BASE_NATIVE_CLONES
+inline void
+base_native_gaussian(cl_uchar4* out,
+                     const cl_uchar4* in,
+                     const float* filter,
+                     int rows,
+                     int cols,
+                     int filter_width,
+                     size_t begin,
+                     size_t end)
+{
+  int middle = filter_width / 2;
+  size_t row_floats = 4 * (size_t)cols;
+  vector<float> padded(4 * ((size_t)cols + 2 * middle));
+  vector<float> acc(row_floats);
+  float* __restrict p = padded.data();
+  float* __restrict a = acc.data();
+
+  for (size_t r = begin; r < end; ++r) {
+    fill(acc.begin(), acc.end(), 0.0f);
+    for (int i = -middle; i <= middle; ++i) {
+      int h = min(max((int)r + i, 0), rows - 1);
+      auto src = in + (size_t)h * cols;
+      for (int c = -middle; c < cols + middle; ++c) {
+        auto& px = src[min(max(c, 0), cols - 1)];
+        for (int ch = 0; ch < 4; ++ch) {
+          p[4 * (c + middle) + ch] = px.s[ch];
+        }
+      }
+      for (int j = 0; j < filter_width; ++j) {
+        auto weight = filter[(i + middle) * filter_width + j];
+        auto shifted = p + 4 * j;
+        for (size_t x = 0; x < row_floats; ++x) {
+          a[x] += weight * shifted[x];
+        }
+      }
+    }
+    auto dst = out + r * cols;
+    for (int c = 0; c < cols; ++c) {
+      for (int ch = 0; ch < 4; ++ch) {
+        dst[c].s[ch] = (unsigned char)min(max(a[4 * c + ch] + 0.5f, 0.0f), 255.0f);
+      }
+    }
+  }
+}
+
+// Acceleration of body i from all n bodies in structure-of-arrays form, with 8
+// independent accumulators per component so the loop vectorizes.
+BASE_NATIVE_CLONES
+inline void
+base_nbody_accel(const float* __restrict px,
+                 const float* __restrict py,
+                 const float* __restrict pz,
+                 const float* __restrict pm,
+                 size_t n,
+                 size_t i,
+                 float espSqr,
+                 float* acc)
+{
+  const size_t lanes = 8;
+  auto blocked = n / lanes * lanes;
+  float ax[lanes] = {}, ay[lanes] = {}, az[lanes] = {};
+  for (size_t j = 0; j < blocked; j += lanes) {
+    for (size_t k = 0; k < lanes; ++k) {
+      auto dx = px[j + k] - px[i];
+      auto dy = py[j + k] - py[i];
+      auto dz = pz[j + k] - pz[i];
+      auto inv = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz + espSqr);
+      auto s = pm[j + k] * inv * inv * inv;
+      ax[k] += s * dx;
+      ay[k] += s * dy;
+      az[k] += s * dz;
+    }
+  }
+  for (size_t j = blocked; j < n; ++j) {
+    auto dx = px[j] - px[i];
+    auto dy = py[j] - py[i];
+    auto dz = pz[j] - pz[i];
+    auto inv = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz + espSqr);
+    auto s = pm[j] * inv * inv * inv;
+    ax[0] += s * dx;
+    ay[0] += s * dy;
+    az[0] += s * dz;
+  }
+  acc[0] = acc[1] = acc[2] = 0.0f;
+  for (size_t k = 0; k < lanes; ++k) {
+    acc[0] += ax[k];
+    acc[1] += ay[k];
+    acc[2] += az[k];
+  }
+}
+
+// Ray tracing on the host BaseBvh, a port of support/kernels/ray_bvh.cl.
+// Rays diverge too much for lanes, so pixels are only spread over threads.
+
+struct BaseRayVec
+{
+  float x = 0.0f, y = 0.0f, z = 0.0f;
+
+  BaseRayVec() {}
+  BaseRayVec(float x, float y, float z)
+    : x(x)
+    , y(y)
+    , z(z)
+  {}
+
+  BaseRayVec operator+(const BaseRayVec& o) const { return { x + o.x, y + o.y, z + o.z }; }
+  BaseRayVec operator-(const BaseRayVec& o) const { return { x - o.x, y - o.y, z - o.z }; }
+  BaseRayVec operator*(const BaseRayVec& o) const { return { x * o.x, y * o.y, z * o.z }; }
+  BaseRayVec operator*(float f) const { return { x * f, y * f, z * f }; }
+  BaseRayVec& operator+=(const BaseRayVec& o) { return *this = *this + o; }
+};
+
+inline float
+base_ray_dot(const BaseRayVec& a, const BaseRayVec& b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline int
+base_ray_intersect(const Primitive& p, BaseRayVec origin, BaseRayVec dir, float& dist)
+{
+  if (p.type == BASE_RAY_SPHERE) {
+    auto v = origin - BaseRayVec(p.center[0], p.center[1], p.center[2]);
+    auto b = -base_ray_dot(v, dir);
+    auto det = b * b - base_ray_dot(v, v) + p.sq_radius;
+    if (det > 0.0f) {
+      det = sqrtf(det);
+      auto i1 = b - det;
+      auto i2 = b + det;
+      if (i2 > 0.0f) {
+        if (i1 < 0.0f) {
+          if (i2 < dist) {
+            dist = i2;
+            return -1;
+          }
+        } else if (i1 < dist) {
+          dist = i1;
+          return 1;
+        }
+      }
+    }
+    return 0;
+  }
+
+  BaseRayVec n(p.normal[0], p.normal[1], p.normal[2]);
+  auto d = base_ray_dot(n, dir);
+  if (d != 0.0f) {
+    auto t = -(base_ray_dot(n, origin) + p.depth) / d;
+    if (t > 0.0f && t < dist) {
+      dist = t;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+inline float
+base_ray_slab(const BaseBvhNode& node, BaseRayVec origin, BaseRayVec inv_dir, float dist)
+{
+  float o[3] = { origin.x, origin.y, origin.z };
+  float inv[3] = { inv_dir.x, inv_dir.y, inv_dir.z };
+  float t0 = 0.0f;
+  float t1 = dist;
+  for (int a = 0; a < 3; ++a) {
+    auto lo = (node.lo[a] - o[a]) * inv[a];
+    auto hi = (node.hi[a] - o[a]) * inv[a];
+    t0 = max(t0, fmin(lo, hi));
+    t1 = min(t1, fmax(lo, hi));
+  }
+  return t0 <= t1 ? t0 : INFINITY;
+}
+
+// nearest primitive along the ray, -1 if none; shadow stops at the first
+// non-light occluder
+inline int
+base_ray_nearest(const BaseBvh& bvh,
+                 BaseRayVec origin,
+                 BaseRayVec dir,
+                 float& dist,
+                 int& result,
+                 bool shadow)
+{
+  auto prims = bvh.prims.data();
+  int hit = -1;
+  for (int i = 0; i < bvh.n_planes; ++i) {
+    auto r = base_ray_intersect(prims[i], origin, dir, dist);
+    if (r) {
+      hit = i;
+      result = r;
+      if (shadow && !prims[i].is_light) {
+        return hit;
+      }
+    }
+  }
+
+  BaseRayVec inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+  int stack[64];
+  int top = 0;
+  if (bvh.prims.size() > (size_t)bvh.n_planes) {
+    stack[top++] = 0;
+  }
+  while (top) {
+    auto& node = bvh.nodes[stack[--top]];
+    if (base_ray_slab(node, origin, inv_dir, dist) == INFINITY) {
+      continue;
+    }
+    if (node.count) {
+      for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+        auto r = base_ray_intersect(prims[i], origin, dir, dist);
+        if (r) {
+          hit = i;
+          result = r;
+          if (shadow && !prims[i].is_light) {
+            return hit;
+          }
+        }
+      }
+      continue;
+    }
+    // nearer child on top of the stack
+    int left = node.left_first;
+    auto tl = base_ray_slab(bvh.nodes[left], origin, inv_dir, dist);
+    auto tr = base_ray_slab(bvh.nodes[left + 1], origin, inv_dir, dist);
+    int near = tl <= tr ? left : left + 1;
+    int far = tl <= tr ? left + 1 : left;
+    if (max(tl, tr) != INFINITY) {
+      stack[top++] = far;
+    }
+    if (min(tl, tr) != INFINITY) {
+      stack[top++] = near;
+    }
+  }
+  return hit;
+}
+
+inline BaseRayVec
+base_ray_trace(const BaseBvh& bvh, int max_depth, BaseRayVec origin, BaseRayVec dir)
+{
+  const float epsilon = 0.0001f;
+  struct Ray
+  {
+    BaseRayVec origin, dir, weight, absorb;
+    float rindex;
+    int depth;
+    bool refracted;
+  };
+
+  auto prims = bvh.prims.data();
+  BaseRayVec acc;
+  Ray stack[16];
+  int top = 0;
+  stack[top++] = { origin, dir, { 1.0f, 1.0f, 1.0f }, {}, 1.0f, 1, false };
+
+  while (top) {
+    auto ray = stack[--top];
+    float dist = 1000000.0f;
+    int result = 0;
+    auto hit = base_ray_nearest(bvh, ray.origin, ray.dir, dist, result, false);
+    if (hit < 0) {
+      continue;
+    }
+    auto& p = prims[hit];
+    auto weight = ray.weight;
+    if (ray.refracted) {
+      auto f = -0.15f * dist;
+      weight = weight * BaseRayVec(expf(ray.absorb.x * f), expf(ray.absorb.y * f),
+                                   expf(ray.absorb.z * f));
+    }
+    if (p.is_light) {
+      acc += weight;
+      continue;
+    }
+
+    auto point = ray.origin + ray.dir * dist;
+    BaseRayVec center(p.center[0], p.center[1], p.center[2]);
+    auto n = p.type == BASE_RAY_SPHERE ? (point - center) * p.r_radius
+                                       : BaseRayVec(p.normal[0], p.normal[1], p.normal[2]);
+    BaseRayVec color(p.m_color[0], p.m_color[1], p.m_color[2]);
+
+    for (int l = 0; l < bvh.n_lights; ++l) {
+      auto& light = prims[bvh.lights[l]];
+      auto to_light = BaseRayVec(light.center[0], light.center[1], light.center[2]) - point;
+      auto light_dist = sqrtf(base_ray_dot(to_light, to_light));
+      to_light = to_light * (1.0f / light_dist);
+
+      float shade = 1.0f;
+      auto shadow_dist = light_dist;
+      int shadow_result = 0;
+      auto occluder = base_ray_nearest(
+        bvh, point + to_light * epsilon, to_light, shadow_dist, shadow_result, true);
+      if (occluder >= 0 && !prims[occluder].is_light) {
+        shade = 0.0f;
+      }
+
+      BaseRayVec light_color(light.m_color[0], light.m_color[1], light.m_color[2]);
+      if (p.m_diff > 0.0f) {
+        auto d = base_ray_dot(n, to_light);
+        if (d > 0.0f) {
+          acc += weight * color * light_color * (d * p.m_diff * shade);
+        }
+      }
+      if (p.m_spec > 0.0f) {
+        auto r = to_light - n * (2.0f * base_ray_dot(to_light, n));
+        auto d = base_ray_dot(ray.dir, r);
+        if (d > 0.0f) {
+          acc += weight * light_color * (powf(d, 20.0f) * p.m_spec * shade);
+        }
+      }
+    }
+
+    if (ray.depth >= max_depth) {
+      continue;
+    }
+    if (p.m_refl > 0.0f && top < 16) {
+      auto r = ray.dir - n * (2.0f * base_ray_dot(ray.dir, n));
+      stack[top++] = {
+        point + r * epsilon, r, weight * color * p.m_refl, {}, ray.rindex, ray.depth + 1, false
+      };
+    }
+    if (p.m_refr > 0.0f && top < 16) {
+      auto rindex = p.m_refr_index;
+      auto ratio = ray.rindex / rindex;
+      auto nn = n * (float)result;
+      auto cos_i = -base_ray_dot(nn, ray.dir);
+      auto cos_t2 = 1.0f - ratio * ratio * (1.0f - cos_i * cos_i);
+      if (cos_t2 > 0.0f) {
+        auto t = ray.dir * ratio + nn * (ratio * cos_i - sqrtf(cos_t2));
+        stack[top++] = { point + t * epsilon, t, weight, color, rindex, ray.depth + 1, true };
+      }
+    }
+  }
+  return acc;
+}
+
+// Pixels [begin, end) of the image seen from the camera into out (pixel begin
+// first).
+BASE_NATIVE_CLONES
+inline void
+base_native_ray(Pixel* out,
+                const BaseBvh& bvh,
+                int width,
+                int height,
+                float camera_x,
+                float camera_y,
+                float camera_z,
+                float viewp_w,
+                float viewp_h,
+                int depth,
+                size_t begin,
+                size_t end)
+{
+  auto dx = viewp_w / width;
+  auto dy = viewp_h / height;
+  BaseRayVec origin(camera_x, camera_y, camera_z);
+  for (size_t idx = begin; idx < end; ++idx) {
+    int x = idx % width;
+    int y = idx / width;
+    BaseRayVec target(-viewp_w / 2.0f + x * dx, viewp_h / 2.0f - y * dy, 0.0f);
+    auto dir = target - origin;
+    dir = dir * (1.0f / sqrtf(base_ray_dot(dir, dir)));
+    auto c = base_ray_trace(bvh, depth, origin, dir);
+    auto sat = [](float v) { return (unsigned char)min(max(v * 255.0f, 0.0f), 255.0f); };
+    out[idx - begin] = { { sat(c.x), sat(c.y), sat(c.z), 255 } };
+  }
+}
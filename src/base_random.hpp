@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "base_config.hpp"
+#include "base_native.hpp"
+
+// Counter-based input generation (Philox4x32-10).
+//
+// Every block of 4 values is a pure function of (seed, stream, block index),
+// so an array can be filled by any number of threads, in any order, straight
+// into a mapped device buffer, and still hold the same data on every platform.
+// stream keeps the arrays of one benchmark apart. Values are floats in [0, 1)
+// with 24 random bits. With config.input set to "philox" the benchmarks fill
+// their inputs through base_random_fill() instead of the serial rand().
+
+struct BasePhilox
+{
+  uint64_t seed;
+  uint32_t stream;
+
+  static array<uint32_t, 4>
+  block(uint64_t index, uint32_t stream, uint64_t seed)
+  {
+    array<uint32_t, 4> c = { (uint32_t)index, (uint32_t)(index >> 32), stream, 0 };
+    uint32_t k0 = (uint32_t)seed;
+    uint32_t k1 = (uint32_t)(seed >> 32);
+    for (int round = 0; round < 10; ++round) {
+      uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+      uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+      c = { (uint32_t)(p1 >> 32) ^ c[1] ^ k0,
+            (uint32_t)p1,
+            (uint32_t)(p0 >> 32) ^ c[3] ^ k1,
+            (uint32_t)p0 };
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    return c;
+  }
+
+  // the 4 values of block index
+  array<float, 4>
+  uniform4(uint64_t index) const
+  {
+    auto bits = block(index, stream, seed);
+    array<float, 4> u;
+    for (int i = 0; i < 4; ++i) {
+      u[i] = (bits[i] >> 8) * (1.0f / 16777216.0f);
+    }
+    return u;
+  }
+};
+
+inline bool
+base_random_philox(const BaseConfig& config)
+{
+  if (config.input != "rand" && config.input != "philox") {
+    throw runtime_error("invalid input generator: " + config.input);
+  }
+  return config.input == "philox";
+}
+
+// fill(index, values) stores block index of [0, n), blocks are spread over
+// the native threads; fill may write into a mapped buffer as well
+template<class F>
+void
+base_random_fill(const BaseConfig& config, uint32_t stream, size_t n, F fill)
+{
+  BasePhilox rng{ (uint64_t)config.input_seed, stream };
+  base_native_for(base_native_threads(config), n, 1 << 14, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      fill(i, rng.uniform4(i));
+    }
+  });
+}
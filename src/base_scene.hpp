@@ -0,0 +1,174 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary ray tracer scenes.
+//
+// A text scene goes through ray_begin(), which parses it into a malloc'd
+// data.A. The binary format is a 4096-byte header (magic, version,
+// sizeof(Primitive), primitive count and the camera defaults) followed by the
+// Primitive array as it is laid out in memory. BaseScene maps it read/write
+// and private, so the primitives start page aligned and can be uploaded
+// straight from the mapping or wrapped with CL_MEM_USE_HOST_PTR; the pages
+// are read on first touch. The file is written by base_scene_write(), see
+// do_ray_convert() for the text to binary converter.
+
+struct BaseSceneHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t primitive_bytes;
+  uint64_t n_primitives;
+  int32_t depth;
+  float viewp_w;
+  float viewp_h;
+  float camera_x;
+  float camera_y;
+  float camera_z;
+};
+
+static const char base_scene_magic[8] = { 'E', 'C', 'L', 'S', 'C', 'E', 'N', 'E' };
+static const uint32_t base_scene_version = 1;
+static const size_t base_scene_offset = 4096;
+
+inline bool
+base_scene_is_binary(const string& path)
+{
+  char magic[sizeof(base_scene_magic)] = {};
+  auto f = fopen(path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  auto n = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  return n == sizeof(magic) && memcmp(magic, base_scene_magic, sizeof(magic)) == 0;
+}
+
+// Writes the primitives and the camera of a loaded data_t; the file appears
+// under path only once it is complete.
+inline void
+base_scene_write(const string& path, const data_t& data)
+{
+  vector<char> header(base_scene_offset, 0);
+  auto h = reinterpret_cast<BaseSceneHeader*>(header.data());
+  memcpy(h->magic, base_scene_magic, sizeof(base_scene_magic));
+  h->version = base_scene_version;
+  h->primitive_bytes = sizeof(Primitive);
+  h->n_primitives = data.n_primitives;
+  h->depth = data.depth;
+  h->viewp_w = data.viewp_w;
+  h->viewp_h = data.viewp_h;
+  h->camera_x = data.camera_x;
+  h->camera_y = data.camera_y;
+  h->camera_z = data.camera_z;
+
+  auto tmp = path + ".tmp." + to_string(getpid());
+  auto f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    throw runtime_error("cannot write scene: " + tmp);
+  }
+  auto bytes = (size_t)data.n_primitives * sizeof(Primitive);
+  auto ok = fwrite(header.data(), 1, header.size(), f) == header.size() &&
+            fwrite(data.A, 1, bytes, f) == bytes;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    throw runtime_error("cannot write scene: " + path);
+  }
+}
+
+struct BaseScene
+{
+  typedef std::chrono::steady_clock clock;
+
+  bool binary = false;
+  void* map = nullptr;
+  size_t map_bytes = 0;
+  // the ray_begin allocation of a text scene
+  Primitive* parsed = nullptr;
+  int64_t load_ns = 0;
+
+  BaseScene() = default;
+  BaseScene(const BaseScene&) = delete;
+  BaseScene& operator=(const BaseScene&) = delete;
+
+  ~BaseScene()
+  {
+    if (map) {
+      munmap(map, map_bytes);
+    }
+    free(parsed);
+  }
+
+  // Fills data.A, data.n_primitives and, for a binary scene, the camera
+  // defaults; data.C is only allocated by the text path (ray_begin).
+  void
+  load(data_t& data, const string& path)
+  {
+    auto load_init = clock::now();
+    binary = base_scene_is_binary(path);
+    if (!binary) {
+      ray_begin(&data);
+      parsed = data.A;
+    } else {
+      map_file(path);
+      auto h = reinterpret_cast<const BaseSceneHeader*>(map);
+      data.A = reinterpret_cast<Primitive*>(static_cast<char*>(map) + base_scene_offset);
+      data.n_primitives = h->n_primitives;
+      data.C = nullptr;
+      data.depth = h->depth;
+      data.viewp_w = h->viewp_w;
+      data.viewp_h = h->viewp_h;
+      data.camera_x = h->camera_x;
+      data.camera_y = h->camera_y;
+      data.camera_z = h->camera_z;
+    }
+    load_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - load_init).count();
+  }
+
+  void
+  map_file(const string& path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw runtime_error("cannot open scene: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < base_scene_offset) {
+      close(fd);
+      throw runtime_error("truncated scene: " + path);
+    }
+    map_bytes = st.st_size;
+    // private pages: writes (none are expected) never reach the file
+    map = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      map = nullptr;
+      throw runtime_error("cannot map scene: " + path);
+    }
+    madvise(map, map_bytes, MADV_WILLNEED);
+
+    auto h = reinterpret_cast<const BaseSceneHeader*>(map);
+    if (h->version != base_scene_version || h->primitive_bytes != sizeof(Primitive)) {
+      throw runtime_error("incompatible scene: " + path);
+    }
+    if (base_scene_offset + h->n_primitives * sizeof(Primitive) > map_bytes) {
+      throw runtime_error("truncated scene: " + path);
+    }
+  }
+
+  void
+  print(int n_primitives) const
+  {
+    cout << "scene: " << (binary ? "binary" : "text") << " primitives " << n_primitives
+         << " load " << load_ns / 1000 << " us\n";
+  }
+};
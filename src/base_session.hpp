@@ -0,0 +1,473 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base_cache.hpp"
+#include "base_config.hpp"
+#include "base_memory.hpp"
+#include "base_stats.hpp"
+#include "base_timer.hpp"
+#include "base_trace.hpp"
+
+// OpenCL runtime state shared across do_*_base runs.
+//
+// A session discovers the selected platform/device once and keeps its context,
+// queue, programs and kernels alive, so a warm run only pays for buffer setup,
+// launch and readback. A session is bound to the device picked on its first run.
+//
+// Source builds go through the binary cache when config.cache_dir is set.
+// timer holds the phase breakdown of the current run.
+//
+// With config.devices set, the session opens the first listed device itself
+// and one peer session per remaining device for co-execution (BaseCoexec).
+//
+// overlap switches the transfers of BaseLaunch to their own queues for the
+// current run; measure() sets it from config.overlap.
+//
+// trace holds the profiled commands of the current run (see base_trace.hpp);
+// enqueues pass event(name, queue) as their event argument.
+
+struct BaseSessionRecord
+{
+  size_t cold_runs = 0;
+  size_t cold_ms = 0;
+  size_t warm_runs = 0;
+  size_t warm_ms = 0;
+};
+
+inline string
+base_build_options()
+{
+  string options;
+  options.reserve(32);
+  options += "-DECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED=" +
+    to_string(ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED);
+  return options;
+}
+
+struct BaseSession
+{
+  BaseConfig config = BaseConfig::from_env();
+  BasePhaseTimer timer;
+  BaseTrace trace;
+
+  uint sel_platform = 0;
+  uint sel_device = 0;
+  bool opened = false;
+  bool overlap = false;
+
+  cl::Platform platform;
+  cl::Device device;
+  cl::Context context;
+  cl::CommandQueue queue;
+  vector<cl::CommandQueue> extra_queues;
+
+  map<string, cl::Program> programs;
+  map<string, cl::Kernel> kernels;
+  map<string, BaseSessionRecord> records;
+  // total times of the measured runs of the last measure()
+  BaseStats last_stats;
+
+  vector<unique_ptr<BaseSession>> peers;
+
+  bool
+  has_program(const string& name) const
+  {
+    return programs.count(name) > 0;
+  }
+
+  void
+  open(const CUnits& cunits)
+  {
+    if (config.devices.empty()) {
+      open(cunits.sel_platform, cunits.sel_device);
+      return;
+    }
+
+    auto devices = base_parse_devices(config.devices);
+    open(devices[0].first, devices[0].second);
+    if (peers.empty()) {
+      for (size_t i = 1; i < devices.size(); ++i) {
+        peers.emplace_back(new BaseSession());
+        peers.back()->config = config;
+        peers.back()->overlap = overlap;
+        peers.back()->open(devices[i].first, devices[i].second);
+      }
+      timer.mark("context");
+    }
+  }
+
+  // all devices of the session, itself first
+  vector<BaseSession*>
+  units()
+  {
+    vector<BaseSession*> list = { this };
+    for (auto& peer : peers) {
+      list.push_back(peer.get());
+    }
+    return list;
+  }
+
+  void
+  open(uint platform_index, uint device_index)
+  {
+    if (opened) {
+      if (platform_index != sel_platform || device_index != sel_device) {
+        throw runtime_error("session already open on another device");
+      }
+      return;
+    }
+
+    vector<cl::Platform> platforms;
+
+    IF_LOGGING(cout << "discoverDevices\n");
+    cl::Platform::get(&platforms);
+    IF_LOGGING(cout << "platforms: " << platforms.size() << "\n");
+    if (platform_index >= platforms.size()) {
+      throw runtime_error("invalid platform selected");
+    }
+    platform = platforms[platform_index];
+
+    // only the selected platform is asked for its devices
+    vector<cl::Device> devices;
+    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    IF_LOGGING(cout << "platform: " << platform_index << " devices: " << devices.size() << "\n");
+    if (device_index >= devices.size()) {
+      throw runtime_error("invalid device selected");
+    }
+    device = move(devices[device_index]);
+    timer.mark("discovery");
+
+    cl_int cl_err = CL_SUCCESS;
+    context = cl::Context(device);
+
+    queue = cl::CommandQueue(context, device, queue_properties(), &cl_err);
+    CL_CHECK_ERROR(cl_err, "CommandQueue queue");
+    timer.mark("context");
+
+    sel_platform = platform_index;
+    sel_device = device_index;
+    opened = true;
+  }
+
+  // in-order queue i on the device: 0 is queue, the others are created on first use
+  cl::CommandQueue&
+  queue_at(size_t i)
+  {
+    if (i == 0) {
+      return queue;
+    }
+    while (extra_queues.size() < i) {
+      cl_int cl_err = CL_SUCCESS;
+      extra_queues.emplace_back(context, device, queue_properties(), &cl_err);
+      CL_CHECK_ERROR(cl_err, "CommandQueue queue");
+    }
+    return extra_queues[i - 1];
+  }
+
+  bool
+  profiling() const
+  {
+    return config.profile || !config.trace.empty();
+  }
+
+  cl_command_queue_properties
+  queue_properties() const
+  {
+    return profiling() ? CL_QUEUE_PROFILING_ENABLE : 0;
+  }
+
+  size_t
+  queue_index(const cl::CommandQueue& q) const
+  {
+    for (size_t i = 0; i < extra_queues.size(); ++i) {
+      if (&q == &extra_queues[i]) {
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+  // the event argument of an enqueue on one of this session's queues
+  cl::Event*
+  event(const string& name, const cl::CommandQueue& q)
+  {
+    return profiling() ? trace.add(name, queue_index(q)) : nullptr;
+  }
+
+  // same for an enqueue that needs its event itself
+  void
+  traced(const string& name, const cl::CommandQueue& q, const cl::Event& event)
+  {
+    if (profiling()) {
+      trace.add(name, queue_index(q), event);
+    }
+  }
+
+  cl::Program&
+  load_program(const string& name,
+               const string& source_str,
+               vector<char> kernel_bin,
+               bool use_binaries)
+  {
+    auto it = programs.find(name);
+    if (it != programs.end()) {
+      return it->second;
+    }
+
+    IF_LOGGING(cout << "initKernel\n");
+
+    auto build_init = std::chrono::steady_clock::now();
+
+    auto options = base_build_options();
+    BaseBinaryCache cache{ config.cache_dir };
+    auto use_cache = cache.enabled() && !use_binaries;
+    auto from_cache = false;
+    string cache_key;
+
+    cl::Program program;
+    if (use_cache) {
+      cache_key = BaseBinaryCache::key(
+        source_str, device_info(CL_DEVICE_NAME), device_info(CL_DRIVER_VERSION), options);
+      vector<char> cached_bin;
+      if (cache.load(name, cache_key, cached_bin)) {
+        from_cache = build_program(program, cached_bin, "", true, options) == CL_SUCCESS;
+        if (!from_cache) {
+          IF_LOGGING(cout << "binary cache: stale entry for " << name << "\n");
+          cache.evict(name, cache_key);
+        }
+      }
+    }
+
+    if (!from_cache) {
+      auto cl_err = build_program(program, kernel_bin, source_str, use_binaries, options);
+      if (cl_err != CL_SUCCESS) {
+        IF_LOGGING(cout << " Error building: "
+                        << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << "\n");
+        CL_CHECK_ERROR(cl_err);
+      }
+      if (use_cache) {
+        auto binary = base_program_binary(program);
+        if (binary.size()) {
+          cache.store(name, cache_key, binary);
+        }
+      }
+    }
+
+    if (use_cache) {
+      auto build_end = std::chrono::steady_clock::now();
+      auto build_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(build_end - build_init).count();
+      cout << "build: " << (from_cache ? "cached" : "source") << " " << build_us << " us\n";
+    }
+
+    return programs[name] = move(program);
+  }
+
+  cl_int
+  build_program(cl::Program& program,
+                const vector<char>& kernel_bin,
+                const string& source_str,
+                bool use_binaries,
+                const string& options)
+  {
+    cl_int cl_err = CL_SUCCESS;
+    cl::Program::Sources sources;
+    cl::Program::Binaries binaries;
+
+    if (use_binaries) {
+      binaries.push_back({ kernel_bin.data(), kernel_bin.size() });
+      vector<cl_int> status = { -1 };
+      program = cl::Program(context, { device }, binaries, &status, &cl_err);
+      if (cl_err != CL_SUCCESS) {
+        IF_LOGGING(cout << "building program from binary failed for device\n");
+        return cl_err;
+      }
+    } else {
+      sources.push_back({ source_str.c_str(), source_str.length() });
+      program = cl::Program(context, sources);
+    }
+
+    return program.build({ device }, options.c_str());
+  }
+
+  string
+  device_info(cl_int param)
+  {
+    string m_info_buffer;
+    m_info_buffer.reserve(128);
+    CL_CHECK_ERROR(device.getInfo(param, &m_info_buffer));
+    if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
+      m_info_buffer.erase(m_info_buffer.size() - 1, 1);
+    return m_info_buffer;
+  }
+
+  cl::Kernel&
+  kernel(const string& name, const string& kernel_str)
+  {
+    auto key = name + "/" + kernel_str;
+    auto it = kernels.find(key);
+    if (it != kernels.end()) {
+      return it->second;
+    }
+
+    auto pit = programs.find(name);
+    if (pit == programs.end()) {
+      throw runtime_error("program not loaded: " + name);
+    }
+
+    cl_int cl_err = CL_SUCCESS;
+    cl::Kernel kernel(pit->second, kernel_str.c_str(), &cl_err);
+    CL_CHECK_ERROR(cl_err, "kernel " + kernel_str);
+
+    return kernels[key] = move(kernel);
+  }
+
+  void
+  record(const string& name, bool cold, size_t diff_ms)
+  {
+    auto& rec = records[name];
+    if (cold) {
+      rec.cold_runs++;
+      rec.cold_ms += diff_ms;
+    } else {
+      rec.warm_runs++;
+      rec.warm_ms += diff_ms;
+    }
+  }
+
+  // Runs the measured region config.warmup + config.iterations times and
+  // returns the time handed to success()/failure(): the single run, or the
+  // median of the measured runs. Callers generate their inputs before calling
+  // measure(), so every run sees the same data. Runs without a program (the
+  // do_*_native ones) are cold the first time only. With config.overlap at 2
+  // the runs alternate between in-order (even) and overlapped (odd) transfers
+  // and the gain of the overlapped ones is reported.
+  template<class F>
+  size_t
+  measure(const string& name, F run)
+  {
+    auto repeat = config.warmup > 0 || config.iterations > 1;
+    BaseStats stats;
+    BaseStats overlap_stats[2];
+    last_stats = BaseStats();
+    base_host_memory().reset_peak();
+    base_reset_peak_rss();
+
+    for (long iter = 0; iter < config.warmup + config.iterations; ++iter) {
+      auto cold = !has_program(name) && !records.count(name);
+      auto overlapped = config.overlap == 1 || (config.overlap == 2 && iter % 2 == 1);
+      overlap = overlapped;
+      for (auto unit : units()) {
+        unit->trace.clear();
+        unit->overlap = overlapped;
+      }
+      run();
+      auto diff_ms = timer.total_ms();
+      record(name, cold, diff_ms);
+
+      if (!repeat) {
+        last_stats.add(timer.total_ns());
+        cout << "time: " << diff_ms << "\n";
+        cout << "session: " << (cold ? "cold" : "warm") << "\n";
+        timer.print(name, cold);
+        print_memory();
+        print_trace(name);
+        return diff_ms;
+      }
+
+      if (iter >= config.warmup) {
+        stats.add(timer.total_ns());
+        overlap_stats[overlapped].add(timer.total_ns());
+        cout << "phases: " << timer.json(name, cold) << "\n";
+      }
+    }
+
+    last_stats = stats;
+    size_t diff_ms = stats.median() / 1000000;
+    cout << "time: " << diff_ms << "\n";
+    cout << "warmup: " << config.warmup << " iterations: " << config.iterations << "\n";
+    stats.print(name);
+    if (config.overlap == 2) {
+      print_overlap(overlap_stats[0], overlap_stats[1]);
+    }
+    print_memory();
+    print_trace(name);
+    return diff_ms;
+  }
+
+  void
+  print_overlap(const BaseStats& in_order, const BaseStats& overlapped) const
+  {
+    auto w = base_welch(in_order, overlapped);
+    auto base = in_order.median();
+    auto gain = base > 0 ? (base - overlapped.median()) / base * 100.0 : 0.0;
+    cout << "overlap: in-order " << in_order.size() << " runs median " << base / 1000
+         << " us overlapped " << overlapped.size() << " runs median " << overlapped.median() / 1000
+         << " us gain " << gain << "% p " << w.p << "\n";
+  }
+
+  // commands of the last run, and its timeline with config.trace set
+  void
+  print_trace(const string& name)
+  {
+    if (!profiling()) {
+      return;
+    }
+    vector<string> events;
+    auto list = units();
+    for (size_t i = 0; i < list.size(); ++i) {
+      auto unit = list[i];
+      unit->trace.collect();
+      auto label = name + " device " + to_string(i);
+      unit->trace.print(label);
+      if (!config.trace.empty()) {
+        unit->trace.append_json(events, i + 1, label, unit->timer, timer.time_init);
+      }
+    }
+    if (!config.trace.empty()) {
+      base_trace_write(config.trace, events);
+    }
+  }
+
+  // high-water marks since measure() started, device bytes of the last run
+  void
+  print_memory() const
+  {
+    cout << "memory: peak rss " << base_peak_rss_kb() << " kB host "
+         << base_host_memory().peak.load() << " B device " << timer.counter("device_bytes")
+         << " B\n";
+  }
+
+  void
+  report() const
+  {
+    for (auto& it : records) {
+      auto& rec = it.second;
+      cout << "session " << it.first << ": cold " << rec.cold_runs << " runs, "
+           << (rec.cold_runs ? rec.cold_ms / rec.cold_runs : 0) << " ms avg; warm "
+           << rec.warm_runs << " runs, " << (rec.warm_runs ? rec.warm_ms / rec.warm_runs : 0)
+           << " ms avg\n";
+    }
+  }
+
+  void
+  print_selected()
+  {
+    string m_info_buffer;
+    m_info_buffer.reserve(128);
+    CL_CHECK_ERROR(platform.getInfo(CL_PLATFORM_NAME, &m_info_buffer));
+
+    if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
+      m_info_buffer.erase(m_info_buffer.size() - 1, 1);
+    cout << "Selected platform: " << m_info_buffer << "\n";
+    CL_CHECK_ERROR(device.getInfo(CL_DEVICE_NAME, &m_info_buffer));
+    if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
+      m_info_buffer.erase(m_info_buffer.size() - 1, 1);
+    cout << "Selected device: " << m_info_buffer << "\n";
+  }
+};
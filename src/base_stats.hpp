@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Summary statistics of repeated measurements (in nanoseconds).
+
+struct BaseStats
+{
+  vector<int64_t> samples;
+
+  void
+  add(int64_t sample)
+  {
+    samples.push_back(sample);
+  }
+
+  size_t
+  size() const
+  {
+    return samples.size();
+  }
+
+  double
+  min() const
+  {
+    return samples.empty() ? 0.0 : *min_element(samples.begin(), samples.end());
+  }
+
+  double
+  max() const
+  {
+    return samples.empty() ? 0.0 : *max_element(samples.begin(), samples.end());
+  }
+
+  double
+  mean() const
+  {
+    if (samples.empty()) {
+      return 0.0;
+    }
+    double sum = 0.0;
+    for (auto s : samples) {
+      sum += s;
+    }
+    return sum / samples.size();
+  }
+
+  // sample standard deviation
+  double
+  stddev() const
+  {
+    if (samples.size() < 2) {
+      return 0.0;
+    }
+    auto m = mean();
+    double sum = 0.0;
+    for (auto s : samples) {
+      sum += (s - m) * (s - m);
+    }
+    return sqrt(sum / (samples.size() - 1));
+  }
+
+  // linear interpolation between closest ranks, p in [0, 100]
+  double
+  percentile(double p) const
+  {
+    if (samples.empty()) {
+      return 0.0;
+    }
+    auto sorted = samples;
+    sort(sorted.begin(), sorted.end());
+    auto rank = p / 100.0 * (sorted.size() - 1);
+    auto lo = (size_t)floor(rank);
+    auto hi = (size_t)ceil(rank);
+    return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+  }
+
+  double
+  median() const
+  {
+    return percentile(50.0);
+  }
+
+  // two-sided 95% Student t quantile for df degrees of freedom
+  static double
+  t95(size_t df)
+  {
+    static const double table[] = { 0.0,   12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+                                    2.306, 2.262,  2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+                                    2.120, 2.110,  2.101, 2.093, 2.086, 2.080, 2.074, 2.069,
+                                    2.064, 2.060,  2.056, 2.052, 2.048, 2.045, 2.042 };
+    if (df == 0) {
+      return 0.0;
+    }
+    if (df <= 30) {
+      return table[df];
+    }
+    if (df <= 60) {
+      return 2.000;
+    }
+    if (df <= 120) {
+      return 1.980;
+    }
+    return 1.960;
+  }
+
+  // 95% confidence interval half width of the mean
+  double
+  ci95() const
+  {
+    if (samples.size() < 2) {
+      return 0.0;
+    }
+    return t95(samples.size() - 1) * stddev() / sqrt((double)samples.size());
+  }
+
+  string
+  json(const string& bench) const
+  {
+    auto m = mean();
+    auto ci = ci95();
+    stringstream ss;
+    ss << fixed << setprecision(0) << "{\"bench\":\"" << bench << "\",\"n\":" << size()
+       << ",\"min_ns\":" << min() << ",\"median_ns\":" << median() << ",\"mean_ns\":" << m
+       << ",\"p95_ns\":" << percentile(95.0) << ",\"p99_ns\":" << percentile(99.0)
+       << ",\"stddev_ns\":" << stddev() << ",\"ci95_ns\":[" << m - ci << "," << m + ci << "]}";
+    return ss.str();
+  }
+
+  void
+  print(const string& bench) const
+  {
+    auto us = [](double ns) { return ns / 1000.0; };
+    auto m = mean();
+    auto ci = ci95();
+    cout << fixed << setprecision(3);
+    cout << "stats (us): n " << size() << " min " << us(min()) << " median " << us(median())
+         << " mean " << us(m) << " p95 " << us(percentile(95.0)) << " p99 "
+         << us(percentile(99.0)) << " stddev " << us(stddev()) << " ci95 [" << us(m - ci)
+         << ", " << us(m + ci) << "]\n";
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+    cout << "stats: " << json(bench) << "\n";
+  }
+};
+
+// Welch's unequal-variance t-test of b against a: diff = mean(b) - mean(a).
+struct BaseWelch
+{
+  double diff = 0.0;
+  double se = 0.0;
+  double t = 0.0;
+  double df = 0.0;
+  // two-sided
+  double p = 1.0;
+  // 95% confidence interval half width of diff
+  double ci95 = 0.0;
+};
+
+// regularized incomplete beta I_x(a, b), continued fraction (Lentz)
+inline double
+base_incomplete_beta(double a, double b, double x)
+{
+  if (x <= 0.0 || x >= 1.0) {
+    return x <= 0.0 ? 0.0 : 1.0;
+  }
+  if (x > (a + 1.0) / (a + b + 2.0)) {
+    return 1.0 - base_incomplete_beta(b, a, 1.0 - x);
+  }
+  const double tiny = 1e-300;
+  auto front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1.0 - x)) / a;
+  double f = 1.0;
+  double c = 1.0;
+  double d = 0.0;
+  for (int i = 0; i <= 200; ++i) {
+    int m = i / 2;
+    double numerator;
+    if (i == 0) {
+      numerator = 1.0;
+    } else if (i % 2 == 0) {
+      numerator = (m * (b - m) * x) / ((a + 2.0 * m - 1.0) * (a + 2.0 * m));
+    } else {
+      numerator = -((a + m) * (a + b + m) * x) / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+    }
+    d = 1.0 + numerator * d;
+    d = 1.0 / (fabs(d) < tiny ? tiny : d);
+    c = 1.0 + numerator / c;
+    c = fabs(c) < tiny ? tiny : c;
+    f *= c * d;
+    if (fabs(1.0 - c * d) < 1e-12) {
+      break;
+    }
+  }
+  return front * (f - 1.0);
+}
+
+inline BaseWelch
+base_welch(const BaseStats& a, const BaseStats& b)
+{
+  BaseWelch w;
+  if (a.size() < 2 || b.size() < 2) {
+    return w;
+  }
+  auto va = a.stddev() * a.stddev() / a.size();
+  auto vb = b.stddev() * b.stddev() / b.size();
+  w.diff = b.mean() - a.mean();
+  w.se = sqrt(va + vb);
+  if (w.se == 0.0) {
+    w.p = w.diff == 0.0 ? 1.0 : 0.0;
+    return w;
+  }
+  w.t = w.diff / w.se;
+  w.df = (va + vb) * (va + vb) /
+         (va * va / (a.size() - 1) + vb * vb / (b.size() - 1));
+  w.p = base_incomplete_beta(w.df / 2.0, 0.5, w.df / (w.df + w.t * w.t));
+  w.ci95 = BaseStats::t95((size_t)w.df) * w.se;
+  return w;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "base_native.hpp"
+#include "base_session.hpp"
+
+// Size sweeps over the benchmarks and devices (do_sweep in sweep.cpp).
+//
+// Every point becomes a BaseSweepRow: the median total time of its measured
+// runs, the phases and bytes copied of the last run, and the rates derived from
+// them. Items are what the benchmark computes per run (options, pixels or
+// bodies). BaseSweepReport prints each row as it comes and rewrites
+// config.sweep_out after it, so an aborted sweep keeps what it measured; the
+// format follows the extension (.json: array of rows, otherwise CSV with a
+// column per phase seen). report() then lists, per benchmark, the sizes where
+// the fastest device changes.
+
+struct BaseSweepRow
+{
+  string bench;
+  string device;
+  string device_name;
+  string program;
+  long size = 0;
+  int64_t items = 0;
+  int64_t bytes = 0;
+  int64_t time_ns = 0;
+  vector<pair<string, int64_t>> phases;
+  string error;
+
+  double
+  items_per_s() const
+  {
+    return time_ns > 0 ? items * 1e9 / time_ns : 0.0;
+  }
+
+  double
+  gb_per_s() const
+  {
+    return time_ns > 0 ? (double)bytes / time_ns : 0.0;
+  }
+
+  string
+  json() const
+  {
+    stringstream ss;
+    ss << "{\"bench\":\"" << bench << "\",\"device\":\"" << device
+       << "\",\"device_name\":" << BaseTrace::quote(device_name) << ",\"program\":\"" << program
+       << "\",\"size\":" << size << ",\"items\":" << items << ",\"bytes\":" << bytes
+       << ",\"time_ns\":" << time_ns << ",\"items_per_s\":" << items_per_s()
+       << ",\"gb_per_s\":" << gb_per_s() << ",\"phases_ns\":{";
+    for (size_t i = 0; i < phases.size(); ++i) {
+      ss << (i ? "," : "") << "\"" << phases[i].first << "\":" << phases[i].second;
+    }
+    ss << "}";
+    if (!error.empty()) {
+      ss << ",\"error\":" << BaseTrace::quote(error);
+    }
+    ss << "}";
+    return ss.str();
+  }
+};
+
+// "a,b", "a-b*factor" (geometric) and "a-b+step" (arithmetic), mixed freely
+inline vector<long>
+base_sweep_sizes(const string& spec)
+{
+  vector<long> sizes;
+  stringstream ss(spec);
+  string item;
+  while (getline(ss, item, ',')) {
+    auto dash = item.find('-');
+    if (dash == string::npos) {
+      sizes.push_back(stol(item));
+      continue;
+    }
+    auto op = item.find_first_of("*+", dash);
+    if (op == string::npos) {
+      throw runtime_error("invalid sweep range (expected a-b*factor or a-b+step): " + item);
+    }
+    auto first = stol(item.substr(0, dash));
+    auto last = stol(item.substr(dash + 1, op - dash - 1));
+    auto by = stol(item.substr(op + 1));
+    if (first <= 0 || by <= (item[op] == '*' ? 1 : 0)) {
+      throw runtime_error("invalid sweep range: " + item);
+    }
+    for (auto size = first; size <= last; size = item[op] == '*' ? size * by : size + by) {
+      sizes.push_back(size);
+    }
+  }
+  return sizes;
+}
+
+// "bench:sizes;bench:sizes"
+inline vector<pair<string, vector<long>>>
+base_parse_sweep(const string& spec)
+{
+  vector<pair<string, vector<long>>> list;
+  stringstream ss(spec);
+  string item;
+  while (getline(ss, item, ';')) {
+    if (item.empty()) {
+      continue;
+    }
+    auto colon = item.find(':');
+    if (colon == string::npos) {
+      throw runtime_error("invalid sweep entry (expected bench:sizes): " + item);
+    }
+    list.push_back({ item.substr(0, colon), base_sweep_sizes(item.substr(colon + 1)) });
+  }
+  return list;
+}
+
+// the point just measured by session
+inline BaseSweepRow
+base_sweep_row(BaseSession& session,
+               const string& bench,
+               const string& device,
+               bool use_binaries,
+               long size,
+               int64_t items)
+{
+  BaseSweepRow row;
+  row.bench = bench;
+  row.device = device;
+  row.size = size;
+  row.items = items;
+  if (session.opened) {
+    row.device_name = session.device_info(CL_DEVICE_NAME);
+    row.program = use_binaries ? "binary" : "source";
+  } else {
+    row.device_name = string("native ") + base_native_isa();
+    row.program = "native";
+  }
+  row.bytes = session.timer.counter("bytes_copied");
+  row.time_ns = session.last_stats.median();
+  row.phases = session.timer.phases;
+  return row;
+}
+
+struct BaseSweepReport
+{
+  string path;
+  vector<BaseSweepRow> rows;
+
+  void
+  add(const BaseSweepRow& row)
+  {
+    rows.push_back(row);
+    cout << "sweep: " << row.json() << "\n";
+    if (!path.empty()) {
+      write();
+    }
+  }
+
+  void
+  write() const
+  {
+    auto tmp = path + ".tmp";
+    ofstream f(tmp);
+    if (!f) {
+      throw runtime_error("cannot write sweep results: " + tmp);
+    }
+    auto json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+      f << "[\n";
+      for (size_t i = 0; i < rows.size(); ++i) {
+        f << rows[i].json() << (i + 1 < rows.size() ? ",\n" : "\n");
+      }
+      f << "]\n";
+    } else {
+      vector<string> names;
+      for (auto& row : rows) {
+        for (auto& phase : row.phases) {
+          if (find(names.begin(), names.end(), phase.first) == names.end()) {
+            names.push_back(phase.first);
+          }
+        }
+      }
+      f << "bench,device,device_name,program,size,items,bytes,time_ns,items_per_s,gb_per_s";
+      for (auto& name : names) {
+        f << "," << name << "_ns";
+      }
+      f << ",error\n";
+      for (auto& row : rows) {
+        f << row.bench << "," << row.device << "," << csv(row.device_name) << "," << row.program
+          << "," << row.size << "," << row.items << "," << row.bytes << "," << row.time_ns << ","
+          << row.items_per_s() << "," << row.gb_per_s();
+        for (auto& name : names) {
+          int64_t ns = 0;
+          for (auto& phase : row.phases) {
+            if (phase.first == name) {
+              ns = phase.second;
+            }
+          }
+          f << "," << ns;
+        }
+        f << "," << csv(row.error) << "\n";
+      }
+    }
+    f.close();
+    if (!f || rename(tmp.c_str(), path.c_str()) != 0) {
+      throw runtime_error("cannot write sweep results: " + path);
+    }
+  }
+
+  static string
+  csv(string s)
+  {
+    for (size_t i = 0; (i = s.find('"', i)) != string::npos; i += 2) {
+      s.insert(i, 1, '"');
+    }
+    return "\"" + s + "\"";
+  }
+
+  // fastest device per bench and size, and the sizes where it changes
+  void
+  report() const
+  {
+    map<string, map<long, const BaseSweepRow*>> best;
+    for (auto& row : rows) {
+      if (!row.error.empty() || row.time_ns <= 0) {
+        continue;
+      }
+      auto& slot = best[row.bench][row.size];
+      if (!slot || row.time_ns < slot->time_ns) {
+        slot = &row;
+      }
+    }
+    for (auto& bench : best) {
+      const BaseSweepRow* previous = nullptr;
+      for (auto& point : bench.second) {
+        auto row = point.second;
+        if (previous && previous->device != row->device) {
+          cout << "crossover: " << bench.first << " between " << previous->size << " and "
+               << row->size << ": " << previous->device << " -> " << row->device << "\n";
+        }
+        previous = row;
+      }
+      if (previous) {
+        cout << "fastest: " << bench.first << " at " << previous->size << ": " << previous->device
+             << "\n";
+      }
+    }
+  }
+};
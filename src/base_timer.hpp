@@ -0,0 +1,162 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Monotonic per-phase timer of the measured region.
+//
+// mark(phase) charges the time since the previous mark (or start) to phase.
+// Enqueue phases (write, launch) only measure the enqueue cost; waiting for the
+// device shows up in the blocking read. Phases not reached in a run (e.g. build
+// on a warm session) are reported as 0 so rows line up between runs.
+// count(name, n) adds to a per-run counter (e.g. bytes copied) shown alongside.
+// spans keeps every mark in order for the trace timeline (base_trace.hpp).
+
+struct BasePhaseSpan
+{
+  string phase;
+  std::chrono::steady_clock::time_point begin;
+  std::chrono::steady_clock::time_point end;
+};
+
+struct BasePhaseTimer
+{
+  typedef std::chrono::steady_clock clock;
+
+  static const vector<string>&
+  phase_names()
+  {
+    static const vector<string> names = { "set_cunits", "discovery", "context",
+                                          "buffers",    "write",     "build",
+                                          "args",       "launch",    "read" };
+    return names;
+  }
+
+  clock::time_point time_init;
+  clock::time_point time_last;
+  vector<pair<string, int64_t>> phases;
+  vector<pair<string, int64_t>> counters;
+  vector<BasePhaseSpan> spans;
+
+  void
+  start()
+  {
+    phases.clear();
+    counters.clear();
+    spans.clear();
+    for (auto& name : phase_names()) {
+      phases.push_back({ name, 0 });
+    }
+    time_init = time_last = clock::now();
+  }
+
+  void
+  mark(const string& phase)
+  {
+    auto now = clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - time_last).count();
+    spans.push_back({ phase, time_last, now });
+    time_last = now;
+    for (auto& it : phases) {
+      if (it.first == phase) {
+        it.second += ns;
+        return;
+      }
+    }
+    phases.push_back({ phase, ns });
+  }
+
+  void
+  count(const string& name, int64_t n)
+  {
+    for (auto& it : counters) {
+      if (it.first == name) {
+        it.second += n;
+        return;
+      }
+    }
+    counters.push_back({ name, n });
+  }
+
+  int64_t
+  counter(const string& name) const
+  {
+    for (auto& it : counters) {
+      if (it.first == name) {
+        return it.second;
+      }
+    }
+    return 0;
+  }
+
+  int64_t
+  phase_ns(const string& phase) const
+  {
+    for (auto& it : phases) {
+      if (it.first == phase) {
+        return it.second;
+      }
+    }
+    return 0;
+  }
+
+  int64_t
+  total_ns() const
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time_last - time_init).count();
+  }
+
+  size_t
+  total_ms() const
+  {
+    return total_ns() / 1000000;
+  }
+
+  void
+  print_table() const
+  {
+    cout << "phase          time (us)\n";
+    for (auto& it : phases) {
+      cout << "  " << left << setw(12) << it.first << right << setw(12) << fixed << setprecision(3)
+           << it.second / 1000.0 << "\n";
+    }
+    cout << "  " << left << setw(12) << "total" << right << setw(12) << total_ns() / 1000.0
+         << "\n";
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+    for (auto& it : counters) {
+      cout << "  " << left << setw(12) << it.first << right << setw(12) << it.second << "\n";
+    }
+  }
+
+  string
+  json(const string& bench, bool cold) const
+  {
+    stringstream ss;
+    ss << "{\"bench\":\"" << bench << "\",\"session\":\"" << (cold ? "cold" : "warm")
+       << "\",\"phases_ns\":{";
+    for (size_t i = 0; i < phases.size(); ++i) {
+      ss << (i ? "," : "") << "\"" << phases[i].first << "\":" << phases[i].second;
+    }
+    ss << "},\"total_ns\":" << total_ns();
+    if (counters.size()) {
+      ss << ",\"counters\":{";
+      for (size_t i = 0; i < counters.size(); ++i) {
+        ss << (i ? "," : "") << "\"" << counters[i].first << "\":" << counters[i].second;
+      }
+      ss << "}";
+    }
+    ss << "}";
+    return ss.str();
+  }
+
+  void
+  print(const string& bench, bool cold) const
+  {
+    print_table();
+    cout << "phases: " << json(bench, cold) << "\n";
+  }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "base_timer.hpp"
+
+// OpenCL command profiling and the trace timeline of a run.
+//
+// With config.profile or config.trace set, sessions create their queues with
+// CL_QUEUE_PROFILING_ENABLE and every enqueue hands the event it gets from
+// BaseSession::event() (nullptr otherwise) to the runtime. BaseTrace keeps
+// those events with the host time just before the enqueue; after the run each
+// command has its QUEUED, SUBMIT, START and END device times.
+//
+// Device clocks are mapped onto the host steady clock with the largest
+// (host enqueue - QUEUED) difference over the commands, i.e. the tightest
+// bound. The trace is Chrome trace event JSON, also read by Perfetto: one
+// process per device with a "host" track of the BasePhaseTimer phases, one
+// track per queue with the executions, and async "pending" slices from QUEUED
+// to START that show the runtime overhead of each command.
+
+struct BaseTraceCommand
+{
+  typedef std::chrono::steady_clock clock;
+
+  string name;
+  size_t queue = 0;
+  cl::Event event;
+  clock::time_point enqueued;
+  // enqueued was taken before the enqueue call, see BaseTrace::add()
+  bool aligned = true;
+
+  // device ns
+  cl_ulong queued = 0;
+  cl_ulong submit = 0;
+  cl_ulong start = 0;
+  cl_ulong end = 0;
+};
+
+struct BaseTrace
+{
+  typedef std::chrono::steady_clock clock;
+
+  // stable addresses, the runtime writes into the events after add() returns
+  deque<BaseTraceCommand> commands;
+
+  void
+  clear()
+  {
+    commands.clear();
+  }
+
+  cl::Event*
+  add(const string& name, size_t queue)
+  {
+    commands.emplace_back();
+    auto& cmd = commands.back();
+    cmd.name = name;
+    cmd.queue = queue;
+    cmd.enqueued = clock::now();
+    return &cmd.event;
+  }
+
+  // an event the caller already waits on (e.g. a read_events entry), taken
+  // after its enqueue so it is not used for the clock mapping
+  void
+  add(const string& name, size_t queue, const cl::Event& event)
+  {
+    add(name, queue);
+    commands.back().event = event;
+    commands.back().aligned = false;
+  }
+
+  // reads the device times, every command must have been enqueued by now
+  void
+  collect()
+  {
+    for (auto& cmd : commands) {
+      cmd.event.wait();
+      cmd.queued = cmd.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+      cmd.submit = cmd.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+      cmd.start = cmd.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      cmd.end = cmd.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    }
+  }
+
+  // host ns since origin = device ns + offset
+  int64_t
+  offset_ns(clock::time_point origin) const
+  {
+    int64_t offset = INT64_MIN;
+    for (int pass = 0; pass < 2 && offset == INT64_MIN; ++pass) {
+      for (auto& cmd : commands) {
+        if (pass || cmd.aligned) {
+          auto host =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(cmd.enqueued - origin).count();
+          offset = max(offset, host - (int64_t)cmd.queued);
+        }
+      }
+    }
+    return offset == INT64_MIN ? 0 : offset;
+  }
+
+  // queued -> submit, submit -> start and start -> end per command name
+  void
+  print(const string& unit) const
+  {
+    map<string, vector<double>> sums;
+    vector<string> order;
+    for (auto& cmd : commands) {
+      auto& sum = sums[cmd.name];
+      if (sum.empty()) {
+        sum.assign(4, 0.0);
+        order.push_back(cmd.name);
+      }
+      sum[0] += 1;
+      sum[1] += cmd.submit - cmd.queued;
+      sum[2] += cmd.start - cmd.submit;
+      sum[3] += cmd.end - cmd.start;
+    }
+    for (auto& name : order) {
+      auto& sum = sums[name];
+      cout << "profile: " << unit << " " << name << " x" << sum[0] << " queued->submit "
+           << sum[1] / 1000 << " us submit->start " << sum[2] / 1000 << " us exec "
+           << sum[3] / 1000 << " us\n";
+    }
+  }
+
+  static string
+  quote(const string& s)
+  {
+    string out = "\"";
+    for (auto c : s) {
+      if (c == '"' || c == '\\') {
+        out += '\\';
+      }
+      out += c;
+    }
+    return out + "\"";
+  }
+
+  // trace events of one device, ts and dur in us
+  void
+  append_json(vector<string>& events,
+              int pid,
+              const string& label,
+              const BasePhaseTimer& timer,
+              clock::time_point origin) const
+  {
+    auto us = [](int64_t ns) { return to_string(ns / 1000.0); };
+    auto host_ns = [&](clock::time_point t) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+    };
+    auto meta = [&](const string& what, int tid, const string& name) {
+      events.push_back("{\"ph\":\"M\",\"name\":\"" + what + "\",\"pid\":" + to_string(pid) +
+                       ",\"tid\":" + to_string(tid) + ",\"args\":{\"name\":" + quote(name) + "}}");
+    };
+
+    meta("process_name", 0, label);
+    meta("thread_name", 0, "host");
+    for (auto& span : timer.spans) {
+      auto begin = host_ns(span.begin);
+      events.push_back("{\"ph\":\"X\",\"name\":" + quote(span.phase) + ",\"pid\":" +
+                       to_string(pid) + ",\"tid\":0,\"ts\":" + us(begin) +
+                       ",\"dur\":" + us(host_ns(span.end) - begin) + "}");
+    }
+
+    auto offset = offset_ns(origin);
+    vector<bool> named;
+    for (size_t i = 0; i < commands.size(); ++i) {
+      auto& cmd = commands[i];
+      auto tid = (int)cmd.queue + 1;
+      if (named.size() <= cmd.queue) {
+        named.resize(cmd.queue + 1, false);
+      }
+      if (!named[cmd.queue]) {
+        meta("thread_name", tid, "queue " + to_string(cmd.queue));
+        named[cmd.queue] = true;
+      }
+      auto common = ",\"pid\":" + to_string(pid) + ",\"tid\":" + to_string(tid);
+      auto id = ",\"cat\":\"pending\",\"id\":\"" + to_string(pid) + "." + to_string(i) + "\"";
+      events.push_back("{\"ph\":\"b\",\"name\":" + quote(cmd.name) + common + id +
+                       ",\"ts\":" + us(offset + (int64_t)cmd.queued) + "}");
+      events.push_back("{\"ph\":\"e\",\"name\":" + quote(cmd.name) + common + id +
+                       ",\"ts\":" + us(offset + (int64_t)cmd.start) + "}");
+      events.push_back("{\"ph\":\"X\",\"name\":" + quote(cmd.name) + common +
+                       ",\"ts\":" + us(offset + (int64_t)cmd.start) +
+                       ",\"dur\":" + us(cmd.end - cmd.start) + ",\"args\":{\"queued_submit_us\":" +
+                       us(cmd.submit - cmd.queued) + ",\"submit_start_us\":" +
+                       us(cmd.start - cmd.submit) + "}}");
+    }
+  }
+};
+
+inline void
+base_trace_write(const string& path, const vector<string>& events)
+{
+  ofstream f(path);
+  if (!f) {
+    throw runtime_error("cannot write trace: " + path);
+  }
+  f << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  for (size_t i = 0; i < events.size(); ++i) {
+    f << events[i] << (i + 1 < events.size() ? ",\n" : "\n");
+  }
+  f << "]}\n";
+  cout << "trace: " << path << " " << events.size() << " events\n";
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "base_session.hpp"
+
+// Local work-size autotuning.
+//
+// base_tuned_lws() picks the local size of a single-device launch whose kernel
+// args are already set. A tuning database entry for the benchmark, device,
+// driver and global size wins; otherwise, with config.tune set, every legal
+// local size (multiples of CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE up to
+// CL_KERNEL_WORK_GROUP_SIZE that divide gws) is timed on the kernel as the
+// "tune" phase and the fastest is stored. Without either the benchmark's
+// default is kept, unless the kernel cannot run it, in which case the largest
+// legal size is used. The choice is reported as the "lws" counter.
+//
+// The database (config.tune_db) is a text file of
+// "benchmark\tdevice\tdriver\tgws\tlws\tns" lines.
+
+struct BaseTuneDb
+{
+  string path;
+  // key (the first four fields) -> lws, ns
+  map<string, pair<size_t, int64_t>> entries;
+
+  bool
+  enabled() const
+  {
+    return !path.empty();
+  }
+
+  static string
+  key(const string& name, const string& device_name, const string& driver_version, size_t gws)
+  {
+    return name + "\t" + device_name + "\t" + driver_version + "\t" + to_string(gws);
+  }
+
+  void
+  load()
+  {
+    entries.clear();
+    ifstream f(path);
+    string line;
+    while (getline(f, line)) {
+      auto ns_tab = line.rfind('\t');
+      auto lws_tab = ns_tab == string::npos ? string::npos : line.rfind('\t', ns_tab - 1);
+      if (lws_tab == string::npos || lws_tab == 0) {
+        continue;
+      }
+      try {
+        entries[line.substr(0, lws_tab)] = { stoul(line.substr(lws_tab + 1)),
+                                             stoll(line.substr(ns_tab + 1)) };
+      } catch (std::exception&) {
+        IF_LOGGING(cout << "tune db: skipping " << line << "\n");
+      }
+    }
+  }
+
+  bool
+  find(const string& key, size_t& lws) const
+  {
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.first == 0) {
+      return false;
+    }
+    lws = it->second.first;
+    return true;
+  }
+
+  void
+  store(const string& key, size_t lws, int64_t ns)
+  {
+    // merge with entries other runs may have written meanwhile
+    load();
+    entries[key] = { lws, ns };
+
+    // write to a private file first so readers never see a partial database
+    auto tmp_path = path + "." + to_string(getpid()) + ".tmp";
+    {
+      ofstream f(tmp_path, ios::trunc);
+      if (!f) {
+        IF_LOGGING(cout << "tune db: cannot write " << tmp_path << "\n");
+        return;
+      }
+      for (auto& it : entries) {
+        f << it.first << "\t" << it.second.first << "\t" << it.second.second << "\n";
+      }
+      if (!f) {
+        remove(tmp_path.c_str());
+        return;
+      }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+      remove(tmp_path.c_str());
+    }
+  }
+};
+
+// legal local sizes of kernel on the unit's device for a range of gws items
+inline vector<size_t>
+base_tune_candidates(BaseSession& unit, const cl::Kernel& kernel, size_t gws)
+{
+  size_t max_size = 0;
+  size_t multiple = 0;
+  cl_int cl_err = kernel.getWorkGroupInfo(unit.device, CL_KERNEL_WORK_GROUP_SIZE, &max_size);
+  CL_CHECK_ERROR(cl_err, "kernel work-group size");
+  cl_err = kernel.getWorkGroupInfo(
+    unit.device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, &multiple);
+  CL_CHECK_ERROR(cl_err, "kernel work-group size multiple");
+  multiple = max<size_t>(multiple, 1);
+
+  vector<size_t> candidates;
+  for (size_t lws = multiple; lws <= max_size; lws += multiple) {
+    if (gws % lws == 0) {
+      candidates.push_back(lws);
+    }
+  }
+  return candidates;
+}
+
+inline size_t
+base_tuned_lws(BaseSession& unit,
+               const string& name,
+               const cl::Kernel& kernel,
+               size_t gws,
+               size_t lws)
+{
+  typedef std::chrono::steady_clock clock;
+
+  BaseTuneDb db{ unit.config.tune_db };
+  string key;
+  if (db.enabled()) {
+    key = BaseTuneDb::key(
+      name, unit.device_info(CL_DEVICE_NAME), unit.device_info(CL_DRIVER_VERSION), gws);
+    db.load();
+    size_t stored = 0;
+    if (db.find(key, stored)) {
+      unit.timer.count("lws", stored);
+      return stored;
+    }
+  }
+
+  auto candidates = base_tune_candidates(unit, kernel, gws);
+  if (candidates.empty()) {
+    // nothing divides gws, let the runtime reject the default if it must
+    unit.timer.count("lws", lws);
+    return lws;
+  }
+
+  if (!unit.config.tune) {
+    if (find(candidates.begin(), candidates.end(), lws) == candidates.end()) {
+      lws = candidates.back();
+    }
+    unit.timer.count("lws", lws);
+    return lws;
+  }
+
+  // best of 3 launches per candidate, the kernel output is rewritten later
+  const int repeats = 3;
+  auto best = lws;
+  auto best_ns = INT64_MAX;
+  for (auto candidate : candidates) {
+    for (int r = 0; r < repeats; ++r) {
+      auto time_init = clock::now();
+      cl_int cl_err = unit.queue.enqueueNDRangeKernel(kernel,
+                                                      cl::NDRange(0),
+                                                      cl::NDRange(gws),
+                                                      cl::NDRange(candidate),
+                                                      NULL,
+                                                      unit.event("tune", unit.queue));
+      CL_CHECK_ERROR(cl_err, "enqueue kernel");
+      cl_err = unit.queue.finish();
+      CL_CHECK_ERROR(cl_err, "tune finish");
+      auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+      if (ns < best_ns) {
+        best_ns = ns;
+        best = candidate;
+      }
+    }
+  }
+  unit.timer.mark("tune");
+  unit.timer.count("tune_candidates", candidates.size());
+  unit.timer.count("lws", best);
+
+  if (db.enabled()) {
+    db.store(key, best, best_ns);
+  }
+  return best;
+}
@@ -0,0 +1,612 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "base_config.hpp"
+#include "base_native.hpp"
+
+// Host verification of the do_*_base outputs.
+//
+// BaseVerify runs a range checker over [0, n) split into contiguous slices,
+// one per thread, and returns the first mismatching position (or -1) exactly
+// like a serial scan. Full checks keep the harness verdict: check_mandelbrot
+// runs per row band, do_nbody_check's reference step per body slice, and a
+// failing slice falls back to the whole-problem call; compare_gaussian_blur and
+// check_ray only take whole images and run through serial(). Verification time
+// is printed as "verify:" and is never part of diff_ms. The per-element
+// references below estimate sampled checks.
+//
+// With config.verify_sample set, sampled() checks only that many seeded
+// uniform draws (with replacement) plus the first and last `boundary` indices,
+// computing the reference for those alone. The 95% upper bound of the mismatch
+// rate over the whole output (rule of three without mismatches, Wilson score
+// otherwise) comes from the random draws only; the deterministic boundary
+// indices are counted apart.
+
+struct BaseVerify
+{
+  typedef std::chrono::steady_clock clock;
+
+  static const size_t boundary = 16;
+
+  size_t threads;
+  size_t sample;
+  uint64_t seed;
+  int64_t ns = 0;
+
+  // last sampled() run: the random draws, and the boundary indices besides
+  size_t sample_total = 0;
+  size_t sample_size = 0;
+  size_t sample_wrong = 0;
+  size_t boundary_size = 0;
+  size_t boundary_wrong = 0;
+  const char* sample_unit = "elements";
+
+  explicit BaseVerify(const BaseConfig& config)
+    : threads(config.verify_threads ? config.verify_threads
+                                    : max(thread::hardware_concurrency(), 1u))
+    , sample(config.verify_sample)
+    , seed(config.verify_seed)
+  {}
+
+  // whether an output of n elements is sampled rather than fully checked
+  bool
+  sampling(size_t n) const
+  {
+    return sample && sample + 2 * boundary < n;
+  }
+
+  // sample seeded uniform draws, duplicates included
+  vector<size_t>
+  sample_draws(size_t n) const
+  {
+    vector<size_t> draws;
+    mt19937_64 rng(seed);
+    uniform_int_distribution<size_t> pick(0, n - 1);
+    for (size_t i = 0; i < sample; ++i) {
+      draws.push_back(pick(rng));
+    }
+    return draws;
+  }
+
+  // first and last boundary indices
+  vector<size_t>
+  boundary_indices(size_t n) const
+  {
+    vector<size_t> indices;
+    for (size_t i = 0; i < min(boundary, n); ++i) {
+      indices.push_back(i);
+      indices.push_back(n - 1 - i);
+    }
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+    return indices;
+  }
+
+  // check(index) is true when element index matches its reference; every
+  // distinct index is checked once. unit names the elements in print().
+  template<class F>
+  long
+  sampled(size_t n, F check, const char* unit = "elements")
+  {
+    auto draws = sample_draws(n);
+    auto bounds = boundary_indices(n);
+    auto indices = draws;
+    indices.insert(indices.end(), bounds.begin(), bounds.end());
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+
+    vector<char> wrong(indices.size(), 0);
+    vector<long> found;
+    run(indices.size(), 1, found, -1L, [&](size_t begin, size_t end) {
+      long first = -1;
+      for (size_t k = begin; k < end; ++k) {
+        if (!check(indices[k])) {
+          wrong[k] = 1;
+          if (first == -1) {
+            first = indices[k];
+          }
+        }
+      }
+      return first;
+    });
+    auto is_wrong = [&](size_t index) {
+      return wrong[lower_bound(indices.begin(), indices.end(), index) - indices.begin()] != 0;
+    };
+
+    sample_total = n;
+    sample_unit = unit;
+    sample_size = draws.size();
+    sample_wrong = count_if(draws.begin(), draws.end(), is_wrong);
+    boundary_size = bounds.size();
+    boundary_wrong = count_if(bounds.begin(), bounds.end(), is_wrong);
+    for (auto pos : found) {
+      if (pos != -1) {
+        return pos;
+      }
+    }
+    return -1;
+  }
+
+  // 95% upper bound of the mismatch rate from the random draws of the last
+  // sampled() run
+  double
+  error_bound() const
+  {
+    if (!sample_size) {
+      return 0.0;
+    }
+    double s = sample_size;
+    if (!sample_wrong) {
+      return min(1.0, 3.0 / s);
+    }
+    double p = sample_wrong / s;
+    double z = 1.96;
+    return min(1.0,
+               (p + z * z / (2 * s) + z * sqrt(p * (1 - p) / s + z * z / (4 * s * s))) /
+                 (1 + z * z / s));
+  }
+
+  // fraction rule of the last sampled() run: passes when the 95% upper bound
+  // of the mismatch rate is within rate, so a sample estimates the full check
+  // rather than applying its threshold to a noisy ratio
+  bool
+  estimate_within(const string& name, double rate) const
+  {
+    auto bound = error_bound();
+    auto ok = bound <= rate;
+    cout << name << " sampled estimate: " << sample_wrong << " of " << sample_size << " "
+         << sample_unit << " mismatch, error rate <= " << bound << " (95%) threshold " << rate
+         << (ok ? " pass" : " fail") << "\n";
+    if (!ok && sample_size * rate < 3.0) {
+      cout << name << " sampled estimate: a pass needs at least " << (size_t)ceil(3.0 / rate)
+           << " draws\n";
+    }
+    return ok;
+  }
+
+  // check(begin, end) returns the first mismatch in [begin, end) or -1
+  template<class F>
+  long
+  first_mismatch(size_t n, size_t grain, F check)
+  {
+    vector<long> found;
+    run(n, grain, found, -1L, check);
+    // slices are in order, so the first hit is the lowest position
+    for (auto pos : found) {
+      if (pos != -1) {
+        return pos;
+      }
+    }
+    return -1;
+  }
+
+  // count(begin, end) returns the mismatches in [begin, end)
+  template<class F>
+  size_t
+  mismatches(size_t n, size_t grain, F count)
+  {
+    vector<size_t> found;
+    run(n, grain, found, (size_t)0, count);
+    size_t total = 0;
+    for (auto c : found) {
+      total += c;
+    }
+    return total;
+  }
+
+  template<class T, class F>
+  void
+  run(size_t n, size_t grain, vector<T>& found, T none, F check)
+  {
+    auto time_init = clock::now();
+
+    grain = max<size_t>(grain, 1);
+    auto slices = max<size_t>(1, min(threads, (n + grain - 1) / grain));
+    // slice bounds are multiples of grain so checkers can keep their own blocking
+    auto slice = (n / slices + grain - 1) / grain * grain;
+    found.assign(slices, none);
+    vector<exception_ptr> errors(slices);
+    vector<thread> workers;
+    for (size_t s = 0; s < slices; ++s) {
+      auto begin = min(n, s * slice);
+      auto end = s == slices - 1 ? n : min(n, begin + slice);
+      workers.emplace_back([&, s, begin, end]() {
+        try {
+          if (begin < end) {
+            found[s] = check(begin, end);
+          }
+        } catch (...) {
+          errors[s] = current_exception();
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+
+    for (auto& error : errors) {
+      if (error) {
+        rethrow_exception(error);
+      }
+    }
+  }
+
+  template<class F>
+  auto
+  serial(F check) -> decltype(check())
+  {
+    auto time_init = clock::now();
+    auto result = check();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_init).count();
+    return result;
+  }
+
+  void
+  print() const
+  {
+    cout << "verify: " << ns / 1000 << " us threads " << threads << "\n";
+    if (sample_size) {
+      cout << "verify sample: " << sample_size << " random of " << sample_total << " "
+           << sample_unit << " mismatches " << sample_wrong << " error rate <= "
+           << error_bound() << " (95%)\n";
+      cout << "verify boundary: " << boundary_size << " mismatches " << boundary_wrong << "\n";
+    }
+  }
+};
+
+// N-body reference step for bodies [begin, end) (the AMD SDK NBody CPU
+// reference that do_nbody_check runs), first body whose position or velocity
+// is off by more than threshold (relative, absolute below 1) or -1. Positions
+// are copied to structure-of-arrays form once so the inner loop over all
+// bodies vectorizes (base_nbody_accel).
+struct BaseNbodyReference
+{
+  vector<float> x, y, z, m;
+
+  BaseNbodyReference(const float* pos, size_t n)
+    : x(n)
+    , y(n)
+    , z(n)
+    , m(n)
+  {
+    for (size_t i = 0; i < n; ++i) {
+      x[i] = pos[4 * i];
+      y[i] = pos[4 * i + 1];
+      z[i] = pos[4 * i + 2];
+      m[i] = pos[4 * i + 3];
+    }
+  }
+
+  long
+  check(size_t begin,
+        size_t end,
+        float delT,
+        float espSqr,
+        const float* vel_in,
+        const float* pos_out,
+        const float* vel_out,
+        float threshold) const
+  {
+    auto off = [threshold](float ref, float got) {
+      return fabs(ref - got) > threshold * max(1.0f, fabs(ref));
+    };
+
+    for (size_t i = begin; i < end; ++i) {
+      float acc[3];
+      base_nbody_accel(x.data(), y.data(), z.data(), m.data(), x.size(), i, espSqr, acc);
+
+      float pos[3] = { x[i], y[i], z[i] };
+      for (int c = 0; c < 3; ++c) {
+        auto v = vel_in[4 * i + c];
+        auto new_pos = pos[c] + v * delT + acc[c] * 0.5f * delT * delT;
+        auto new_vel = v + acc[c] * delT;
+        if (off(new_pos, pos_out[4 * i + c]) || off(new_vel, vel_out[4 * i + c])) {
+          return i;
+        }
+      }
+    }
+    return -1;
+  }
+};
+
+// do_nbody_check with BaseVerify: BaseNbodyReference over body slices on the
+// threads, or over a sample of bodies. A mismatch over the slices is handed to
+// do_nbody_check through serial(), whose verdict stands.
+inline bool
+base_check_nbody(BaseVerify& verify,
+                 uint num_bodies,
+                 float delT,
+                 float espSqr,
+                 float* pos_in,
+                 float* vel_in,
+                 float* pos_out,
+                 float* vel_out,
+                 float threshold)
+{
+  BaseNbodyReference reference(pos_in, num_bodies);
+  auto check_bodies = [&](size_t begin, size_t end) {
+    return reference.check(begin, end, delT, espSqr, vel_in, pos_out, vel_out, threshold);
+  };
+  if (verify.sampling(num_bodies)) {
+    auto pos = verify.sampled(
+      num_bodies, [&](size_t body) { return check_bodies(body, body + 1) == -1; }, "bodies");
+    if (pos != -1) {
+      cout << "first mismatch: body " << pos << "\n";
+    }
+    return pos == -1;
+  }
+
+  auto pos = verify.first_mismatch(num_bodies, 64, check_bodies);
+  if (pos == -1) {
+    return true;
+  }
+  cout << "first mismatch: body " << pos << "\n";
+  return verify.serial([&]() {
+    return do_nbody_check(num_bodies, delT, espSqr, pos_in, vel_in, pos_out, vel_out, threshold);
+  });
+}
+
+// Pixel of the 2D gaussian_blur with clamped borders, recomputed on the host:
+// whether every color channel of the output is within tolerance of it. The
+// four channels are summed as one vector lane group, like the native kernel.
+BASE_NATIVE_CLONES
+inline bool
+base_gaussian_pixel_ok(const Gaussian& gaussian,
+                       int width,
+                       int height,
+                       int filter_width,
+                       size_t pixel,
+                       float tolerance)
+{
+  int row = pixel / width;
+  int col = pixel % width;
+  int middle = filter_width / 2;
+  float blur[4] = {};
+  for (int i = -middle; i <= middle; ++i) {
+    for (int j = -middle; j <= middle; ++j) {
+      int h = min(max(row + i, 0), height - 1);
+      int w = min(max(col + j, 0), width - 1);
+      auto weight = gaussian._b[(i + middle) * filter_width + j + middle];
+      auto& in = gaussian._a[h * width + w];
+      for (int c = 0; c < 4; ++c) {
+        blur[c] += weight * in.s[c];
+      }
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    if (fabs(blur[c] - gaussian._c[pixel].s[c]) > tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reference for the step counts check_binomial was not written for: the
+// binomial_options lattice in double for samples [0, n), 8 options per lane
+// group like base_native_binomial, first sample off by more than threshold or -1
+BASE_NATIVE_CLONES
+inline long
+base_binomial_reference(const float* in,
+                        const float* out,
+                        size_t n,
+                        uint steps,
+                        float threshold)
+{
+  const size_t lanes = 8;
+  vector<double> call((steps + 1) * lanes);
+  double* __restrict c = call.data();
+
+  for (size_t first = 0; first < n; first += lanes) {
+    auto count = min(lanes, n - first);
+    double s[lanes], x[lanes], vsdt[lanes], pu_r[lanes], pd_r[lanes];
+    for (size_t k = 0; k < lanes; ++k) {
+      double r = k < count ? in[first + k] : 0.0;
+      s[k] = (1.0 - r) * 5.0 + r * 30.0;
+      x[k] = (1.0 - r) * 1.0 + r * 100.0;
+      auto years = (1.0 - r) * 0.25 + r * 10.0;
+      auto dt = years / steps;
+      vsdt[k] = BASE_BINOMIAL_VOLATILITY * sqrt(dt);
+      auto rate = exp(BASE_BINOMIAL_RISKFREE * dt);
+      auto u = exp(vsdt[k]);
+      auto d = 1.0 / u;
+      auto pu = (rate - d) / (u - d);
+      pu_r[k] = pu / rate;
+      pd_r[k] = (1.0 - pu) / rate;
+    }
+
+    for (uint t = 0; t <= steps; ++t) {
+      for (size_t k = 0; k < lanes; ++k) {
+        c[t * lanes + k] = max(s[k] * exp(vsdt[k] * (2.0 * t - steps)) - x[k], 0.0);
+      }
+    }
+    for (uint j = steps; j > 0; --j) {
+      for (uint t = 0; t < j; ++t) {
+        for (size_t k = 0; k < lanes; ++k) {
+          c[t * lanes + k] = pu_r[k] * c[t * lanes + k] + pd_r[k] * c[(t + 1) * lanes + k];
+        }
+      }
+    }
+    for (size_t k = 0; k < count; ++k) {
+      if (fabs(c[k] - out[first + k]) > threshold) {
+        return first + k;
+      }
+    }
+  }
+  return -1;
+}
+
+// Binomial check over cl_float4 vectors, first mismatching sample or -1.
+// check_binomial keeps the legacy 254 steps, per slice on the threads; a
+// failing slice is confirmed by the whole-output call through serial(). There
+// base_binomial_reference runs alongside and the run reports whether both find
+// the same first mismatch, which backs the reference at the other depths.
+inline long
+base_check_binomial(BaseVerify& verify,
+                    float* in,
+                    float* out,
+                    size_t vectors,
+                    uint steps,
+                    float threshold)
+{
+  auto legacy = steps == 254;
+  atomic<bool> agree(true);
+  auto check_slice = [&](size_t begin, size_t end) -> long {
+    auto n = 4 * (end - begin);
+    auto reference =
+      base_binomial_reference(in + 4 * begin, out + 4 * begin, n, steps, threshold);
+    if (legacy) {
+      long pos = check_binomial(in + 4 * begin, out + 4 * begin, end - begin, n, steps, threshold);
+      if (pos != reference) {
+        agree = false;
+      }
+      reference = pos;
+    }
+    return reference == -1 ? -1 : reference + 4 * begin;
+  };
+
+  long pos;
+  if (verify.sampling(vectors)) {
+    pos = verify.sampled(
+      vectors, [&](size_t vector) { return check_slice(vector, vector + 1) == -1; }, "vectors");
+    pos = pos == -1 ? -1 : 4 * pos;
+  } else {
+    pos = verify.first_mismatch(vectors, 64, check_slice);
+    if (pos != -1 && legacy) {
+      pos = verify.serial([&]() {
+        return check_binomial(in, out, vectors, 4 * vectors, steps, threshold);
+      });
+    }
+  }
+  if (legacy) {
+    cout << "binomial reference: " << (agree ? "agrees" : "disagrees")
+         << " with check_binomial\n";
+  } else {
+    cout << "binomial reference: lattice in double at " << steps << " steps\n";
+  }
+  if (pos != -1) {
+    cout << "first mismatch: sample " << pos << "\n";
+  }
+  return pos;
+}
+
+// check_mandelbrot over the whole image, its mismatch fraction within
+// threshold. Row bands are checked on the threads first: the image fraction is
+// the mean of the band fractions, so it passes when every band does. Only a
+// failing band makes the whole-image call through serial() decide.
+inline bool
+base_check_mandelbrot(BaseVerify& verify,
+                      cl_uchar4* out,
+                      float leftx,
+                      float topy,
+                      float xstep,
+                      float ystep,
+                      uint max_iterations,
+                      int width,
+                      int height,
+                      int bench,
+                      float threshold)
+{
+  auto check_band = [&](size_t begin, size_t end) -> long {
+    auto band_ok = check_mandelbrot(out + begin * width,
+                                    leftx,
+                                    topy + begin * ystep,
+                                    xstep,
+                                    ystep,
+                                    max_iterations,
+                                    width,
+                                    end - begin,
+                                    bench,
+                                    threshold);
+    return band_ok ? -1 : begin;
+  };
+  if (verify.first_mismatch(height, 1, check_band) == -1) {
+    return true;
+  }
+  return verify.serial([&]() {
+    return check_mandelbrot(
+      out, leftx, topy, xstep, ystep, max_iterations, width, height, bench, threshold);
+  });
+}
+
+// Whether pixel (x, y) is within 1 per channel of base_native_mandelbrot,
+// iterated alone for sampled checks (cloned the same way, so FMA contraction
+// matches)
+BASE_NATIVE_CLONES
+inline bool
+base_mandelbrot_pixel_matches(const cl_uchar4* out,
+                              float leftx,
+                              float topy,
+                              float xstep,
+                              float ystep,
+                              uint max_iterations,
+                              int width,
+                              int bench,
+                              size_t x,
+                              size_t y)
+{
+  auto x0 = leftx + xstep * (float)x;
+  auto y0 = topy + ystep * (float)y;
+  auto zx = x0;
+  auto zy = y0;
+  uint count = 0;
+  for (; count < max_iterations; ++count) {
+    auto x2 = zx * zx;
+    auto y2 = zy * zy;
+    if (x2 + y2 > 4.0f) {
+      break;
+    }
+    auto nx = x2 - y2 + x0;
+    zy = 2.0f * zx * zy + y0;
+    zx = nx;
+  }
+  auto expected = base_native_mandelbrot_color(count, zx, zy, max_iterations, bench);
+  auto got = out[y * width + x];
+  for (int c = 0; c < 4; ++c) {
+    if (abs(expected.s[c] - got.s[c]) > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// First pixel of [begin, end) whose color channels are off by more than
+// threshold (of full scale) from base_native_ray on bvh, or -1
+inline long
+base_check_ray(const Pixel* out,
+               const BaseBvh& bvh,
+               const data_t& data,
+               size_t begin,
+               size_t end,
+               float threshold)
+{
+  vector<Pixel> expected(end - begin);
+  base_native_ray(expected.data(),
+                  bvh,
+                  data.width,
+                  data.height,
+                  data.camera_x,
+                  data.camera_y,
+                  data.camera_z,
+                  data.viewp_w,
+                  data.viewp_h,
+                  data.depth,
+                  begin,
+                  end);
+  for (size_t i = begin; i < end; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      if (abs(expected[i - begin].s[c] - out[i].s[c]) > threshold * 255.0f) {
+        return i;
+      }
+    }
+  }
+  return -1;
+}
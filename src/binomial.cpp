@@ -1,5 +1,6 @@
 void
-do_binomial_base(int tscheduler,
+do_binomial_base(BaseSession& session,
+                 int tscheduler,
                  int tdevices,
                  uint check,
                  int samples,
@@ -7,14 +8,16 @@ do_binomial_base(int tscheduler,
                  bool use_binaries,
                  vector<float>& props)
 {
-  string source_str;
-  try {
-    source_str = file_read("support/kernels/binomial.cl");
-  } catch (std::ios::failure& e) {
-    cout << "io failure: " << e.what() << "\n";
-  }
+  uint steps = session.config.binomial_steps;
 
-  uint steps = 254;
+  // binomial_options runs steps + 1 items per work-group, which caps steps at
+  // the device limit (the legacy 254 everywhere); binomial_blocked does not
+  auto& mode = session.config.binomial_kernel;
+  if (mode != "auto" && mode != "local" && mode != "blocked") {
+    throw runtime_error("invalid binomial kernel: " + mode);
+  }
+  auto blocked = mode == "blocked" || (mode == "auto" && steps > 254);
+  string name = blocked ? "binomial_blocked" : "binomial";
 
   samples = (samples / 4) ? (samples / 4) * 4 : 4;
 
@@ -23,164 +26,364 @@ do_binomial_base(int tscheduler,
   size_t gws = steps1 * samplesPerVectorWidth;
   size_t out_size = samplesPerVectorWidth;
 
-  int worksize = chunksize;
-
   auto in_size = samplesPerVectorWidth;
-  auto in_array = make_shared<vector<cl_float4>>(in_size);
+  auto in_array = make_shared<base_vector<cl_float4>>(in_size);
   float* in_ptr = reinterpret_cast<float*>(in_array.get()->data());
-  for (uint i = 0; i < samples; ++i) {
-    float f = (float)rand() / (float)RAND_MAX;
-    in_ptr[i] = f;
+  if (base_random_philox(session.config)) {
+    base_random_fill(session.config, 0, samplesPerVectorWidth, [&](size_t i, array<float, 4> u) {
+      copy(u.begin(), u.end(), in_ptr + 4 * i);
+    });
+  } else {
+    for (uint i = 0; i < samples; ++i) {
+      float f = (float)rand() / (float)RAND_MAX;
+      in_ptr[i] = f;
+    }
   }
 
-  auto out_array = make_shared<vector<cl_float4>>(out_size);
+  auto out_array = make_shared<base_vector<cl_float4>>(out_size);
   float* out_ptr = reinterpret_cast<float*>(out_array.get()->data());
   for (uint i = 0; i < samples; ++i) {
     out_ptr[i] = 0.0f;
   }
 
-  auto lws = steps1;
-
-  auto sel_platform = PLATFORM;
-  auto sel_device = DEVICE;
-
-  CUnits cunits;
-  set_cunits(cunits, use_binaries, tdevices, "binomial", true, false);
-
-  auto time_init = std::chrono::system_clock::now().time_since_epoch();
-
-  set_cunits(cunits, use_binaries, tdevices, "binomial", false, false);
-
-  vector<char> kernel_bin = move(cunits.kernel_bin);
+  size_t lws = steps1;
+
+  string kernel_str = blocked ? "binomial_blocked" : "binomial_options";
+
+  // blocked: lws items per lattice, per_group option vectors per work-group,
+  // block levels per pass over the lattice
+  size_t groups = 0;
+  size_t per_group = 0;
+  size_t block = 0;
+
+  // Streaming: chunks of chunk_items cl_float4 go through a ring of device
+  // buffer slots, so device memory only holds slots chunks at a time.
+  size_t chunk_items = min((size_t)session.config.binomial_chunk, (size_t)in_size);
+  size_t slots = session.config.binomial_slots;
+  size_t chunks = chunk_items ? (in_size + chunk_items - 1) / chunk_items : 0;
+  BaseStats stream_stats;
+
+  auto measured = [&]() {
+    auto cold = !session.has_program(name);
+
+    string source_str;
+    CUnits cunits;
+    if (cold) {
+      try {
+        source_str = file_read("support/kernels/" + name + ".cl");
+      } catch (std::ios::failure& e) {
+        cout << "io failure: " << e.what() << "\n";
+      }
+      set_cunits(cunits, use_binaries, tdevices, name, true, false);
+    }
 
-  sel_platform = cunits.sel_platform;
-  sel_device = cunits.sel_device;
+    session.timer.start();
 
-  auto in_bytes = in_size * sizeof(cl_float4);
-  auto out_bytes = out_size * sizeof(cl_float4);
+    if (cold) {
+      set_cunits(cunits, use_binaries, tdevices, name, false, false);
+      session.timer.mark("set_cunits");
+      session.open(cunits);
+    }
 
-  vector<cl::Platform> platforms;
-  vector<vector<cl::Device>> platfordevices;
-  cl::Device device;
+    if (blocked) {
+      // Every device gets the same groups, so any package maps to a range of
+      // option vectors: as many lattices as a quarter of the smallest maximum
+      // allocation holds, at most one per option vector. The tile width is
+      // what every built kernel accepts (CL_KERNEL_WORK_GROUP_SIZE) and its
+      // cl_float4 tile fits the local memory left by the kernel, so the
+      // program is built here and setup finds it in the session.
+      size_t width = 256;
+      cl_ulong alloc = CL_ULONG_MAX;
+      auto units = session.units();
+      for (size_t index = 0; index < units.size(); ++index) {
+        auto& unit = *units[index];
+        unit.load_program(name,
+                          source_str,
+                          index ? vector<char>() : move(cunits.kernel_bin),
+                          use_binaries && !index);
+        auto& kernel = unit.kernel(name, kernel_str);
+
+        size_t unit_width = 0;
+        size_t kernel_width = 0;
+        cl_ulong unit_alloc = 0;
+        cl_ulong local_bytes = 0;
+        cl_ulong kernel_local_bytes = 0;
+        CL_CHECK_ERROR(unit.device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &unit_width));
+        CL_CHECK_ERROR(unit.device.getInfo(CL_DEVICE_MAX_MEM_ALLOC_SIZE, &unit_alloc));
+        CL_CHECK_ERROR(unit.device.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &local_bytes));
+        CL_CHECK_ERROR(
+          kernel.getWorkGroupInfo(unit.device, CL_KERNEL_WORK_GROUP_SIZE, &kernel_width),
+          "kernel work-group size");
+        CL_CHECK_ERROR(
+          kernel.getWorkGroupInfo(unit.device, CL_KERNEL_LOCAL_MEM_SIZE, &kernel_local_bytes),
+          "kernel local memory");
+        auto tile_bytes = local_bytes > kernel_local_bytes ? local_bytes - kernel_local_bytes : 0;
+        width = min({ width, unit_width, kernel_width, (size_t)(tile_bytes / sizeof(cl_float4)) });
+        alloc = min(alloc, unit_alloc);
+      }
+      session.timer.mark("build");
+      if (width < 2) {
+        throw runtime_error("binomial_blocked needs work-groups of at least 2 items");
+      }
+      auto lattice_bytes = steps1 * sizeof(cl_float4);
+      groups = max<size_t>(1, min<size_t>(in_size, alloc / 4 / lattice_bytes));
+      per_group = (in_size + groups - 1) / groups;
+      groups = (in_size + per_group - 1) / per_group;
+      lws = width;
+      block = width / 4 ? width / 4 : 1;
+      gws = groups * lws;
+    }
 
-  IF_LOGGING(cout << "discoverDevices\n");
-  cl::Platform::get(&platforms);
-  IF_LOGGING(cout << "platforms: " << platforms.size() << "\n");
-  auto i = 0;
-  for (auto& platform : platforms) {
-    vector<cl::Device> devices;
-    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    IF_LOGGING(cout << "platform: " << i++ << " devices: " << devices.size() << "\n");
-    platfordevices.push_back(move(devices));
-  }
+    auto in_bytes = in_size * sizeof(cl_float4);
+    auto out_bytes = out_size * sizeof(cl_float4);
+
+    if (chunk_items) {
+      if (session.units().size() > 1) {
+        throw runtime_error("binomial streaming needs a single device");
+      }
+      if (blocked) {
+        throw runtime_error("binomial streaming needs the local kernel");
+      }
+
+      cl_int cl_err = CL_SUCCESS;
+      auto chunk_bytes = chunk_items * sizeof(cl_float4);
+
+      // upload, compute and download each get an in-order queue
+      auto& in_queue = session.queue_at(0);
+      auto& exec_queue = session.queue_at(1);
+      auto& out_queue = session.queue_at(2);
+
+      vector<cl::Buffer> in_slots;
+      vector<cl::Buffer> out_slots;
+      for (size_t slot = 0; slot < slots; ++slot) {
+        in_slots.emplace_back(session.context, CL_MEM_READ_ONLY, chunk_bytes, nullptr, &cl_err);
+        CL_CHECK_ERROR(cl_err, "buffer");
+        out_slots.emplace_back(session.context, CL_MEM_WRITE_ONLY, chunk_bytes, nullptr, &cl_err);
+        CL_CHECK_ERROR(cl_err, "buffer");
+      }
+      session.timer.count("device_bytes", 2 * slots * chunk_bytes);
+      session.timer.mark("buffers");
+
+      session.load_program(name, source_str, move(cunits.kernel_bin), use_binaries);
+      auto& kernel = session.kernel(name, kernel_str);
+      session.timer.mark("build");
+
+      cl_err = kernel.setArg(0, steps);
+      CL_CHECK_ERROR(cl_err, "kernel arg 0");
+
+      cl_err = kernel.setArg(3, steps1 * sizeof(cl_float4), NULL);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
+
+      cl_err = kernel.setArg(4, steps * sizeof(cl_float4), NULL);
+      CL_CHECK_ERROR(cl_err, "kernel arg 4");
+      session.timer.mark("args");
+
+      auto in_items = reinterpret_cast<cl_float4*>(in_ptr);
+      auto out_items = reinterpret_cast<cl_float4*>(out_ptr);
+      vector<cl::Event> read_events(chunks);
+
+      auto stream_init = std::chrono::steady_clock::now();
+      for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        auto slot = chunk % slots;
+        auto first = chunk * chunk_items;
+        auto items = min(chunk_items, in_size - first);
+        auto bytes = items * sizeof(cl_float4);
+
+        // the slot is free once its previous chunk has been read back
+        vector<cl::Event> slot_free;
+        if (chunk >= slots) {
+          slot_free.push_back(read_events[chunk - slots]);
+        }
+        cl::Event written;
+        cl_err = in_queue.enqueueWriteBuffer(in_slots[slot],
+                                             CL_FALSE,
+                                             0,
+                                             bytes,
+                                             in_items + first,
+                                             slot_free.empty() ? NULL : &slot_free,
+                                             &written);
+        CL_CHECK_ERROR(cl_err, "write buffer");
+        session.traced("write", in_queue, written);
+
+        cl_err = kernel.setArg(1, in_slots[slot]);
+        CL_CHECK_ERROR(cl_err, "kernel arg 1");
+        cl_err = kernel.setArg(2, out_slots[slot]);
+        CL_CHECK_ERROR(cl_err, "kernel arg 2");
+
+        vector<cl::Event> wait_written = { written };
+        cl::Event computed;
+        cl_err = exec_queue.enqueueNDRangeKernel(kernel,
+                                                 cl::NDRange(0),
+                                                 cl::NDRange(items * steps1),
+                                                 cl::NDRange(lws),
+                                                 &wait_written,
+                                                 &computed);
+        CL_CHECK_ERROR(cl_err, "enqueue kernel");
+        session.traced("kernel", exec_queue, computed);
+
+        vector<cl::Event> wait_computed = { computed };
+        cl_err = out_queue.enqueueReadBuffer(out_slots[slot],
+                                             CL_FALSE,
+                                             0,
+                                             bytes,
+                                             out_items + first,
+                                             &wait_computed,
+                                             &read_events[chunk]);
+        CL_CHECK_ERROR(cl_err, "read buffer");
+        session.traced("read", out_queue, read_events[chunk]);
+        session.timer.count("bytes_copied", 2 * bytes);
+
+        // start the stages now rather than when the next queue blocks
+        in_queue.flush();
+        exec_queue.flush();
+        out_queue.flush();
+      }
+      session.timer.mark("launch");
+
+      cl_err = out_queue.finish();
+      CL_CHECK_ERROR(cl_err, "read buffer");
+      session.timer.mark("read");
+
+      auto stream_end = std::chrono::steady_clock::now();
+      stream_stats.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stream_end - stream_init).count());
+      session.timer.count("chunks", chunks);
+      return;
+    }
 
-  auto last_platform = platforms.size() - 1;
-  if (sel_platform > last_platform) {
-    throw runtime_error("invalid platform selected");
-  }
+    auto setup = [&](BaseSession& unit, size_t index) {
+      cl_int cl_err = CL_SUCCESS;
+
+      IF_LOGGING(cout << "initBuffers\n");
+
+      cl_int buffer_in_flags = CL_MEM_READ_WRITE;
+      cl_int buffer_out_flags = CL_MEM_READ_WRITE;
+
+      BaseLaunch launch;
+      launch.buffers.emplace_back(unit, buffer_in_flags, in_bytes, in_ptr);
+      launch.buffers.emplace_back(unit, buffer_out_flags, out_bytes, out_ptr);
+      auto& in_buffer = launch.buffers[0];
+      auto& out_buffer = launch.buffers[1];
+      unit.timer.mark("buffers");
+
+      CL_CHECK_ERROR(launch.upload(unit, 0));
+      unit.timer.mark("write");
+
+      // the set_cunits binary only matches the first device
+      unit.load_program(
+        name, source_str, index ? vector<char>() : move(cunits.kernel_bin), use_binaries && !index);
+
+      launch.kernel = unit.kernel(name, kernel_str);
+      auto& kernel = launch.kernel;
+      unit.timer.mark("build");
+
+      cl_err = kernel.setArg(0, steps);
+      CL_CHECK_ERROR(cl_err, "kernel arg 0");
+
+      cl_err = kernel.setArg(1, in_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 1");
+
+      cl_err = kernel.setArg(2, out_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 2");
+
+      if (blocked) {
+        auto lattice_bytes = groups * steps1 * sizeof(cl_float4);
+        launch.scratch.emplace_back(
+          unit.context, CL_MEM_READ_WRITE, lattice_bytes, nullptr, &cl_err);
+        CL_CHECK_ERROR(cl_err, "buffer");
+        unit.timer.count("device_bytes", lattice_bytes);
+
+        cl_err = kernel.setArg(3, launch.scratch[0]);
+        CL_CHECK_ERROR(cl_err, "kernel arg 3");
+
+        cl_err = kernel.setArg(4, lws * sizeof(cl_float4), NULL);
+        CL_CHECK_ERROR(cl_err, "kernel arg 4");
+
+        cl_err = kernel.setArg(5, (cl_uint)in_size);
+        CL_CHECK_ERROR(cl_err, "kernel arg 5");
+
+        cl_err = kernel.setArg(6, (cl_uint)per_group);
+        CL_CHECK_ERROR(cl_err, "kernel arg 6");
+
+        cl_err = kernel.setArg(7, (cl_uint)block);
+        CL_CHECK_ERROR(cl_err, "kernel arg 7");
+
+        launch.offset_arg = 8;
+        if (!ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED) {
+          cl_err = kernel.setArg(8, (cl_uint)0);
+          CL_CHECK_ERROR(cl_err, "kernel arg 8");
+        }
+        unit.timer.mark("args");
+        return launch;
+      }
+
+      cl_err = kernel.setArg(3, steps1 * sizeof(cl_float4), NULL);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
+
+      cl_err = kernel.setArg(4, steps * sizeof(cl_float4), NULL);
+      CL_CHECK_ERROR(cl_err, "kernel arg 4");
+
+      launch.offset_arg = 5;
+      unit.timer.mark("args");
+      return launch;
+    };
+
+    // one work-group of steps1 items prices one cl_float4 of options, a
+    // blocked one per_group of them
+    auto collect = [&](BaseSession& unit, BaseLaunch& launch, size_t offset, size_t size) {
+      if (!blocked) {
+        return launch.download(
+          unit, 1, offset / steps1 * sizeof(cl_float4), size / steps1 * sizeof(cl_float4));
+      }
+      auto first = min((size_t)in_size, offset / lws * per_group);
+      auto last = min((size_t)in_size, (offset + size) / lws * per_group);
+      if (first == last) {
+        return CL_SUCCESS;
+      }
+      return launch.download(
+        unit, 1, first * sizeof(cl_float4), (last - first) * sizeof(cl_float4));
+    };
+
+    // lws is the lattice width (one work-group per option vector) or the
+    // blocked tile width, never tuned
+    BaseCoexec coexec(session, tscheduler, chunksize, props);
+    coexec.run(gws, lws, setup, collect);
+  };
+
+  size_t diff_ms = session.measure("binomial", measured);
+
+  session.print_selected();
 
-  auto last_device = platfordevices[sel_platform].size() - 1;
-  if (sel_device > last_device) {
-    throw runtime_error("invalid device selected");
+  cout << "program type: " << (use_binaries ? "binary" : "source") << "\n";
+  cout << "buffers: " << session.config.buffer_strategy << "\n";
+  cout << "kernel: " << kernel_str << "\n";
+  cout << "steps: " << steps << "\n";
+  if (blocked) {
+    cout << "blocked: groups " << groups << " of " << lws << " items, " << per_group
+         << " option vectors per group, " << block << " levels per pass\n";
   }
 
-  device = move(platfordevices[sel_platform][sel_device]);
-
-  cl_int cl_err = CL_SUCCESS;
-  cl::Context context(device);
-
-  cl::CommandQueue queue(context, device, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "CommandQueue queue");
-
-  IF_LOGGING(cout << "initBuffers\n");
-
-  cl_int buffer_in_flags = CL_MEM_READ_WRITE;
-  cl_int buffer_out_flags = CL_MEM_READ_WRITE;
-
-  cl::Buffer in_buffer(context, buffer_in_flags, in_bytes, NULL);
-  CL_CHECK_ERROR(cl_err, "in buffer ");
-  cl::Buffer out_buffer(context, buffer_out_flags, out_bytes, NULL);
-  CL_CHECK_ERROR(cl_err, "out buffer ");
-
-  CL_CHECK_ERROR(queue.enqueueWriteBuffer(in_buffer, CL_FALSE, 0, in_bytes, in_ptr, NULL));
-
-  IF_LOGGING(cout << "initKernel\n");
-
-  cl::Program::Sources sources;
-  cl::Program::Binaries binaries;
-
-  cl::Program program;
-  if (use_binaries) {
-    binaries.push_back({ kernel_bin.data(), kernel_bin.size() });
-    vector<cl_int> status = { -1 };
-    program = std::move(cl::Program(context, { device }, binaries, &status, &cl_err));
-    CL_CHECK_ERROR(cl_err, "building program from binary failed for device ");
+  if (chunk_items) {
+    // warmup runs are not part of the rate
+    stream_stats.samples.erase(stream_stats.samples.begin(),
+                               stream_stats.samples.begin() + session.config.warmup);
+    auto stream_s = stream_stats.median() / 1e9;
+    cout << "stream: chunks " << chunks << " of " << chunk_items * 4 << " options, slots " << slots
+         << "\n";
+    cout << "options/s: " << (stream_s > 0 ? samples / stream_s : 0.0) << "\n";
   } else {
-    sources.push_back({ source_str.c_str(), source_str.length() });
-    program = std::move(cl::Program(context, sources));
+    // whole runs including transfers, so local and blocked compare at the same
+    // steps (after a warmup run the build is left out)
+    auto run_s = session.last_stats.median() / 1e9;
+    cout << "options/s: " << (run_s > 0 ? samples / run_s : 0.0) << "\n";
   }
 
-  string options;
-  options.reserve(32);
-  options += "-DECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED=" +
-    to_string(ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED);
-
-  cl_err = program.build({ device }, options.c_str());
-  if (cl_err != CL_SUCCESS) {
-    IF_LOGGING(cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)
-               << "\n");
-    CL_CHECK_ERROR(cl_err);
-  }
-
-  string kernel_str = "binomial_options";
-  cl::Kernel kernel(program, kernel_str.c_str(), &cl_err);
-
-  cl_err = kernel.setArg(0, steps);
-  CL_CHECK_ERROR(cl_err, "kernel arg 0");
-
-  cl_err = kernel.setArg(1, in_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 1");
-
-  cl_err = kernel.setArg(2, out_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 2");
-
-  cl_err = kernel.setArg(3, steps1 * sizeof(cl_float4), NULL);
-  CL_CHECK_ERROR(cl_err, "kernel arg 3");
-
-  cl_err = kernel.setArg(4, steps * sizeof(cl_float4), NULL);
-  CL_CHECK_ERROR(cl_err, "kernel arg 4");
-
-  auto offset = 0;
-  cl_err = queue.enqueueNDRangeKernel(
-                                      kernel, cl::NDRange(offset), cl::NDRange(gws), cl::NDRange(lws), NULL, NULL);
-  CL_CHECK_ERROR(cl_err, "enqueue kernel");
-
-  cl_err = queue.enqueueReadBuffer(out_buffer, CL_TRUE, 0, out_bytes, out_ptr);
-  CL_CHECK_ERROR(cl_err, "read buffer");
-
-  auto t2 = std::chrono::system_clock::now().time_since_epoch();
-  size_t diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - time_init).count();
-
-  cout << "time: " << diff_ms << "\n";
-
-  string m_info_buffer;
-  m_info_buffer.reserve(128);
-  CL_CHECK_ERROR(platforms[sel_platform].getInfo(CL_PLATFORM_NAME, &m_info_buffer));
-
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected platform: " << m_info_buffer << "\n";
-  CL_CHECK_ERROR(device.getInfo(CL_DEVICE_NAME, &m_info_buffer));
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected device: " << m_info_buffer << "\n";
-
-  cout << "program type: " << (use_binaries ? "binary" : "source") << "\n";
-  cout << "kernel: " << kernel_str << "\n";
-
   if (check) {
     auto threshold = 0.01f;
-    auto pos = check_binomial(in_ptr, out_ptr, samplesPerVectorWidth, samples, steps, threshold);
+    BaseVerify verify(session.config);
+    auto pos = base_check_binomial(
+      verify, in_ptr, out_ptr, samplesPerVectorWidth, steps, threshold);
+    verify.print();
     auto ok = pos == -1;
 
     if (ok) {
@@ -192,3 +395,17 @@ do_binomial_base(int tscheduler,
     cout << "Done\n";
   }
 }
+
+void
+do_binomial_base(int tscheduler,
+                 int tdevices,
+                 uint check,
+                 int samples,
+                 int chunksize,
+                 bool use_binaries,
+                 vector<float>& props)
+{
+  BaseSession session;
+  do_binomial_base(
+    session, tscheduler, tdevices, check, samples, chunksize, use_binaries, props);
+}
@@ -0,0 +1,84 @@
+void
+do_binomial_native(BaseSession& session,
+                   int tscheduler,
+                   int tdevices,
+                   uint check,
+                   int samples,
+                   int chunksize,
+                   bool use_binaries,
+                   vector<float>& props)
+{
+  uint steps = session.config.binomial_steps;
+
+  samples = (samples / 4) ? (samples / 4) * 4 : 4;
+
+  int samplesPerVectorWidth = samples / 4;
+
+  auto in_array = make_shared<base_vector<cl_float4>>(samplesPerVectorWidth);
+  float* in_ptr = reinterpret_cast<float*>(in_array.get()->data());
+  if (base_random_philox(session.config)) {
+    base_random_fill(session.config, 0, samplesPerVectorWidth, [&](size_t i, array<float, 4> u) {
+      copy(u.begin(), u.end(), in_ptr + 4 * i);
+    });
+  } else {
+    for (uint i = 0; i < samples; ++i) {
+      float f = (float)rand() / (float)RAND_MAX;
+      in_ptr[i] = f;
+    }
+  }
+
+  auto out_array = make_shared<base_vector<cl_float4>>(samplesPerVectorWidth);
+  float* out_ptr = reinterpret_cast<float*>(out_array.get()->data());
+  for (uint i = 0; i < samples; ++i) {
+    out_ptr[i] = 0.0f;
+  }
+
+  // chunksize options per block handed to a thread; tscheduler, tdevices,
+  // use_binaries and props only apply to devices
+  auto threads = base_native_threads(session.config);
+  size_t grain = chunksize > 0 ? chunksize : 64;
+
+  auto measured = [&]() {
+    session.timer.start();
+    base_native_for(threads, samples, grain, [&](size_t begin, size_t end) {
+      base_native_binomial(in_ptr, out_ptr, begin, end, steps);
+    });
+    session.timer.mark("compute");
+  };
+
+  size_t diff_ms = session.measure("binomial_native", measured);
+
+  cout << "native: " << base_native_isa() << " threads " << threads << "\n";
+  cout << "steps: " << steps << "\n";
+
+  if (check) {
+    auto threshold = 0.01f;
+    BaseVerify verify(session.config);
+    auto pos = base_check_binomial(
+      verify, in_ptr, out_ptr, samplesPerVectorWidth, steps, threshold);
+    verify.print();
+    auto ok = pos == -1;
+
+    if (ok) {
+      success(diff_ms);
+    } else {
+      failure(diff_ms);
+    }
+  } else {
+    cout << "Done\n";
+  }
+}
+
+void
+do_binomial_native(int tscheduler,
+                   int tdevices,
+                   uint check,
+                   int samples,
+                   int chunksize,
+                   bool use_binaries,
+                   vector<float>& props)
+{
+  BaseSession session;
+  do_binomial_native(
+    session, tscheduler, tdevices, check, samples, chunksize, use_binaries, props);
+}
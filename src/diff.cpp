@@ -0,0 +1,166 @@
+// Side by side runs of each do_*_base and its ecl::Program counterpart
+// (do_binomial, do_gaussian, ... from the EngineCL benchmarks, same
+// arguments), see base_diff.hpp. Both sides build their runtime per call, so
+// the base side gets a fresh session. Its config is the default BaseConfig
+// whatever ECL_BASE_* says (one run, no warmup, legacy modes), and both sides
+// run with check 0: check is kept in the signatures for the callers only.
+
+void
+do_binomial_diff(int tscheduler,
+                 int tdevices,
+                 uint check,
+                 int samples,
+                 int chunksize,
+                 bool use_binaries,
+                 vector<float>& props)
+{
+  BaseConfig config = BaseConfig::from_env();
+  base_diff(
+    "binomial/" + to_string(samples),
+    config,
+    [&]() {
+      BaseSession session;
+      session.config = BaseConfig();
+      do_binomial_base(session, tscheduler, tdevices, 0, samples, chunksize, use_binaries, props);
+    },
+    [&]() { do_binomial(tscheduler, tdevices, 0, samples, chunksize, use_binaries, props); });
+}
+
+void
+do_gaussian_diff(int tscheduler,
+                 int tdevices,
+                 uint check,
+                 uint image_width,
+                 int chunksize,
+                 bool use_binaries,
+                 vector<float>& props,
+                 uint filter_width)
+{
+  BaseConfig config = BaseConfig::from_env();
+  base_diff("gaussian/" + to_string(image_width) + "/" + to_string(filter_width),
+            config,
+            [&]() {
+              BaseSession session;
+              session.config = BaseConfig();
+              do_gaussian_base(session,
+                               tscheduler,
+                               tdevices,
+                               0,
+                               image_width,
+                               chunksize,
+                               use_binaries,
+                               props,
+                               filter_width);
+            },
+            [&]() {
+              do_gaussian(tscheduler,
+                          tdevices,
+                          0,
+                          image_width,
+                          chunksize,
+                          use_binaries,
+                          props,
+                          filter_width);
+            });
+}
+
+void
+do_mandelbrot_diff(int tscheduler,
+                   int tdevices,
+                   uint check,
+                   int chunksize,
+                   bool use_binaries,
+                   vector<float>& props,
+                   int width,
+                   int height,
+                   double xpos,
+                   double ypos,
+                   double xstep,
+                   double ystep,
+                   uint max_iterations)
+{
+  BaseConfig config = BaseConfig::from_env();
+  base_diff("mandelbrot/" + to_string(width) + "x" + to_string(height) + "/" +
+              to_string(max_iterations),
+            config,
+            [&]() {
+              BaseSession session;
+              session.config = BaseConfig();
+              do_mandelbrot_base(session,
+                                 tscheduler,
+                                 tdevices,
+                                 0,
+                                 chunksize,
+                                 use_binaries,
+                                 props,
+                                 width,
+                                 height,
+                                 xpos,
+                                 ypos,
+                                 xstep,
+                                 ystep,
+                                 max_iterations);
+            },
+            [&]() {
+              do_mandelbrot(tscheduler,
+                            tdevices,
+                            0,
+                            chunksize,
+                            use_binaries,
+                            props,
+                            width,
+                            height,
+                            xpos,
+                            ypos,
+                            xstep,
+                            ystep,
+                            max_iterations);
+            });
+}
+
+void
+do_nbody_diff(int tscheduler,
+              int tdevices,
+              uint check,
+              uint num_particles,
+              int chunksize,
+              bool use_binaries,
+              vector<float>& props)
+{
+  BaseConfig config = BaseConfig::from_env();
+  base_diff(
+    "nbody/" + to_string(num_particles),
+    config,
+    [&]() {
+      BaseSession session;
+      session.config = BaseConfig();
+      do_nbody_base(
+        session, tscheduler, tdevices, 0, num_particles, chunksize, use_binaries, props);
+    },
+    [&]() { do_nbody(tscheduler, tdevices, 0, num_particles, chunksize, use_binaries, props); });
+}
+
+void
+do_ray_diff(int tscheduler,
+            int tdevices,
+            uint check,
+            int wsize,
+            int chunksize,
+            bool use_binaries,
+            vector<float>& props,
+            string scene_path)
+{
+  BaseConfig config = BaseConfig::from_env();
+  base_diff(
+    "ray/" + to_string(wsize),
+    config,
+    [&]() {
+      BaseSession session;
+      session.config = BaseConfig();
+      do_ray_base(
+        session, tscheduler, tdevices, 0, wsize, chunksize, use_binaries, props, scene_path);
+    },
+    [&]() {
+      do_ray(tscheduler, tdevices, 0, wsize, chunksize, use_binaries, props, scene_path);
+    });
+}
@@ -1,5 +1,6 @@
 void
-do_gaussian_base(int tscheduler,
+do_gaussian_base(BaseSession& session,
+                 int tscheduler,
                  int tdevices,
                  uint check,
                  uint image_width,
@@ -10,183 +11,292 @@ do_gaussian_base(int tscheduler,
 {
   uint image_height = image_width;
 
-  int worksize = chunksize;
-
   IF_LOGGING(cout << image_width << "\n");
 
   Gaussian gaussian(image_width, image_height, filter_width);
 
-  string source_str = file_read("support/kernels/gaussian.cl");
-
   int size = gaussian._total_size;
 
-  auto a_array = shared_ptr<vector<cl_uchar4>>(&gaussian._a);
-  auto b_array = shared_ptr<vector<cl_float>>(&gaussian._b);
-  auto c_array = shared_ptr<vector<cl_uchar4>>(&gaussian._c);
-
-  auto sel_platform = PLATFORM;
-  auto sel_device = DEVICE;
-
-  CUnits cunits;
-  set_cunits(cunits, use_binaries, tdevices, "gaussian", true, false);
-
-  auto time_init = std::chrono::system_clock::now().time_since_epoch();
-
-  set_cunits(cunits, use_binaries, tdevices, "gaussian", false, false);
-
-  vector<char> kernel_bin = move(cunits.kernel_bin);
-
-  sel_platform = cunits.sel_platform;
-  sel_device = cunits.sel_device;
-
-  vector<cl::Platform> platforms;
-  vector<vector<cl::Device>> platform_devices;
-  cl::Device device;
+  // views of the arrays owned by gaussian, read in place after the run
+  auto& a_array = gaussian._a;
+  auto& b_array = gaussian._b;
+  auto& c_array = gaussian._c;
 
-  IF_LOGGING(cout << "discoverDevices\n");
-  cl::Platform::get(&platforms);
-  IF_LOGGING(cout << "platforms: " << platforms.size() << "\n");
-  auto i = 0;
-  for (auto& platform : platforms) {
-    vector<cl::Device> devices;
-    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    IF_LOGGING(cout << "platform: " << i++ << " devices: " << devices.size() << "\n");
-    platform_devices.push_back(move(devices));
+  auto& mode = session.config.gaussian_mode;
+  if (mode != "2d" && mode != "separable") {
+    throw runtime_error("invalid gaussian mode: " + mode);
   }
-
-  auto last_platform = platforms.size() - 1;
-  if (sel_platform > last_platform) {
-    throw runtime_error("invalid platform selected");
-  }
-
-  auto last_device = platform_devices[sel_platform].size() - 1;
-  if (sel_device > last_device) {
-    throw runtime_error("invalid device selected");
+  auto separable = mode == "separable";
+  uint band_rows = min((uint)session.config.gaussian_band, image_height);
+  string name = separable ? "gaussian_separable" : "gaussian";
+
+  // 1D weights of the separable passes: the row sums of the 2D filter
+  vector<cl_float> filter_1d(filter_width, 0.0f);
+  for (uint i = 0; i < filter_width; ++i) {
+    for (uint j = 0; j < filter_width; ++j) {
+      filter_1d[i] += gaussian._b[i * filter_width + j];
+    }
   }
 
-  device = move(platform_devices[sel_platform][sel_device]);
+  string kernel_str = separable ? "gaussian_blur_rows/gaussian_blur_cols" : "gaussian_blur";
 
-  cl_int cl_err = CL_SUCCESS;
-  cl::Context context(device);
+  auto measured = [&]() {
+    auto cold = !session.has_program(name);
 
-  cl::CommandQueue queue(context, device, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "CommandQueue queue");
+    string source_str;
+    CUnits cunits;
+    if (cold) {
+      source_str = file_read("support/kernels/" + name + ".cl");
+      set_cunits(cunits, use_binaries, tdevices, name, true, false);
+    }
 
-  IF_LOGGING(cout << "initBuffers\n");
+    session.timer.start();
 
-  cl_int buffer_in_flags = CL_MEM_READ_WRITE;
-  cl_int buffer_out_flags = CL_MEM_READ_WRITE;
+    if (cold) {
+      set_cunits(cunits, use_binaries, tdevices, name, false, false);
+      session.timer.mark("set_cunits");
+      session.open(cunits);
+    }
 
-  IF_LOGGING(cout << a_array.get()->size() << "\n");
-  IF_LOGGING(cout << b_array.get()->size() << "\n");
-  IF_LOGGING(cout << c_array.get()->size() << "\n");
+    // Separable and banded blurs run band by band on one device: every band
+    // uploads its rows plus filter_width/2 halo rows on each side, runs the
+    // filter on that sub-image and reads back its own rows only.
+    if (separable || band_rows) {
+      if (session.units().size() > 1) {
+        throw runtime_error("gaussian separable/banded modes need a single device");
+      }
+
+      auto& context = session.context;
+      auto& queue = session.queue;
+      cl_int cl_err = CL_SUCCESS;
+
+      uint halo = filter_width / 2;
+      uint rows = band_rows ? band_rows : image_height;
+      uint max_band_height = min(rows + 2 * halo, image_height);
+      size_t lws = 128;
+      // rounded up to whole work-groups, the padding is never read back
+      size_t band_items = ((size_t)max_band_height * image_width + lws - 1) / lws * lws;
+
+      cl::Buffer in_buffer(
+        context, CL_MEM_READ_ONLY, band_items * sizeof(cl_uchar4), nullptr, &cl_err);
+      CL_CHECK_ERROR(cl_err, "buffer");
+      cl::Buffer out_buffer(
+        context, CL_MEM_WRITE_ONLY, band_items * sizeof(cl_uchar4), nullptr, &cl_err);
+      CL_CHECK_ERROR(cl_err, "buffer");
+      auto& filter = separable ? filter_1d : gaussian._b;
+      cl::Buffer filter_buffer(
+        context, CL_MEM_READ_ONLY, filter.size() * sizeof(cl_float), nullptr, &cl_err);
+      CL_CHECK_ERROR(cl_err, "buffer");
+      cl::Buffer tmp_buffer;
+      if (separable) {
+        tmp_buffer = cl::Buffer(
+          context, CL_MEM_READ_WRITE, band_items * sizeof(cl_float4), nullptr, &cl_err);
+        CL_CHECK_ERROR(cl_err, "buffer");
+      }
+      session.timer.count("device_bytes",
+                          band_items * (2 * sizeof(cl_uchar4) + separable * sizeof(cl_float4)) +
+                            filter.size() * sizeof(cl_float));
+      session.timer.mark("buffers");
+
+      cl_err = queue.enqueueWriteBuffer(filter_buffer,
+                                        CL_FALSE,
+                                        0,
+                                        filter.size() * sizeof(cl_float),
+                                        filter.data(),
+                                        NULL,
+                                        session.event("write", queue));
+      CL_CHECK_ERROR(cl_err, "write buffer");
+      session.timer.count("bytes_copied", filter.size() * sizeof(cl_float));
+      session.timer.mark("write");
+
+      session.load_program(name, source_str, move(cunits.kernel_bin), use_binaries);
+      vector<cl::Kernel*> passes;
+      if (separable) {
+        passes.push_back(&session.kernel(name, "gaussian_blur_rows"));
+        passes.push_back(&session.kernel(name, "gaussian_blur_cols"));
+      } else {
+        passes.push_back(&session.kernel(name, kernel_str));
+      }
+      session.timer.mark("build");
+
+      // 2d: in -> out, separable: in -> tmp -> out
+      for (size_t pass = 0; pass < passes.size(); ++pass) {
+        auto& kernel = *passes[pass];
+        auto last = pass == passes.size() - 1;
+        cl_err = kernel.setArg(0, last ? out_buffer : tmp_buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 0");
+        cl_err = kernel.setArg(1, pass ? tmp_buffer : in_buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 1");
+        cl_err = kernel.setArg(3, image_width);
+        CL_CHECK_ERROR(cl_err, "kernel arg 3");
+        cl_err = kernel.setArg(4, filter_buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 4");
+        cl_err = kernel.setArg(5, filter_width);
+        CL_CHECK_ERROR(cl_err, "kernel arg 5");
+        if (!separable && !ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED) {
+          cl_err = kernel.setArg(6, (cl_uint)0);
+          CL_CHECK_ERROR(cl_err, "kernel arg 6");
+        }
+      }
+      session.timer.mark("args");
+
+      auto in_pixels = gaussian._a.data();
+      auto out_pixels = gaussian._c.data();
+      size_t bands = 0;
+      for (uint first = 0; first < image_height; first += rows) {
+        auto end = min(first + rows, image_height);
+        auto lo = first >= halo ? first - halo : 0;
+        auto hi = min(end + halo, image_height);
+        uint band_height = hi - lo;
+        size_t items = (size_t)band_height * image_width;
+
+        // the in-order queue keeps this write behind the previous band's read
+        cl_err = queue.enqueueWriteBuffer(in_buffer,
+                                          CL_FALSE,
+                                          0,
+                                          items * sizeof(cl_uchar4),
+                                          in_pixels + (size_t)lo * image_width,
+                                          NULL,
+                                          session.event("write", queue));
+        CL_CHECK_ERROR(cl_err, "write buffer");
+        session.timer.count("bytes_copied", items * sizeof(cl_uchar4));
+        session.timer.mark("write");
+
+        for (auto kernel : passes) {
+          cl_err = kernel->setArg(2, band_height);
+          CL_CHECK_ERROR(cl_err, "kernel arg 2");
+          cl_err = queue.enqueueNDRangeKernel(*kernel,
+                                              cl::NDRange(0),
+                                              cl::NDRange((items + lws - 1) / lws * lws),
+                                              cl::NDRange(lws),
+                                              NULL,
+                                              session.event("kernel", queue));
+          CL_CHECK_ERROR(cl_err, "enqueue kernel");
+        }
+        session.timer.mark("launch");
+
+        auto out_items = (size_t)(end - first) * image_width;
+        cl_err = queue.enqueueReadBuffer(out_buffer,
+                                         CL_FALSE,
+                                         (size_t)(first - lo) * image_width * sizeof(cl_uchar4),
+                                         out_items * sizeof(cl_uchar4),
+                                         out_pixels + (size_t)first * image_width,
+                                         NULL,
+                                         session.event("read", queue));
+        CL_CHECK_ERROR(cl_err, "read buffer");
+        session.timer.count("bytes_copied", out_items * sizeof(cl_uchar4));
+        bands++;
+      }
+
+      cl_err = queue.finish();
+      CL_CHECK_ERROR(cl_err, "read buffer");
+      session.timer.mark("read");
+      session.timer.count("bands", bands);
+      return;
+    }
 
-  cl::Buffer a_buffer(context, buffer_in_flags, sizeof(cl_uchar4) * a_array.get()->size(), NULL);
-  CL_CHECK_ERROR(cl_err, "in1 buffer ");
-  cl::Buffer b_buffer(context, buffer_in_flags, sizeof(cl_float) * b_array.get()->size(), NULL);
-  CL_CHECK_ERROR(cl_err, "in2 buffer ");
-  cl::Buffer c_buffer(context, buffer_out_flags, sizeof(cl_uchar4) * c_array.get()->size(), NULL);
-  CL_CHECK_ERROR(cl_err, "out buffer ");
+    auto setup = [&](BaseSession& unit, size_t index) {
+      cl_int cl_err = CL_SUCCESS;
 
-  CL_CHECK_ERROR(queue.enqueueWriteBuffer(
-                                          a_buffer, CL_FALSE, 0, sizeof(cl_uchar4) * a_array.get()->size(), a_array.get()->data(), NULL));
+      IF_LOGGING(cout << "initBuffers\n");
 
-  CL_CHECK_ERROR(queue.enqueueWriteBuffer(
-                                          b_buffer, CL_FALSE, 0, sizeof(cl_float) * b_array.get()->size(), b_array.get()->data(), NULL));
+      cl_int buffer_in_flags = CL_MEM_READ_WRITE;
+      cl_int buffer_out_flags = CL_MEM_READ_WRITE;
 
-  IF_LOGGING(cout << "initKernel\n");
+      IF_LOGGING(cout << a_array.size() << "\n");
+      IF_LOGGING(cout << b_array.size() << "\n");
+      IF_LOGGING(cout << c_array.size() << "\n");
 
-  cl::Program::Sources sources;
-  cl::Program::Binaries binaries;
-  cl::Program program;
-  if (use_binaries) {
-    binaries.push_back({ kernel_bin.data(), kernel_bin.size() });
-    vector<cl_int> status = { -1 };
-    program = std::move(cl::Program(context, { device }, binaries, &status, &cl_err));
-    CL_CHECK_ERROR(cl_err, "building program from binary failed for device ");
-  } else {
-    sources.push_back({ source_str.c_str(), source_str.length() });
-    program = std::move(cl::Program(context, sources));
-  }
+      BaseLaunch launch;
+      launch.buffers.emplace_back(
+        unit, buffer_in_flags, sizeof(cl_uchar4) * a_array.size(), a_array.data());
+      launch.buffers.emplace_back(
+        unit, buffer_in_flags, sizeof(cl_float) * b_array.size(), b_array.data());
+      launch.buffers.emplace_back(
+        unit, buffer_out_flags, sizeof(cl_uchar4) * c_array.size(), c_array.data());
+      auto& a_buffer = launch.buffers[0];
+      auto& b_buffer = launch.buffers[1];
+      auto& c_buffer = launch.buffers[2];
+      unit.timer.mark("buffers");
 
-  string options;
-  options.reserve(32);
-  options += "-DECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED=" +
-    to_string(ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED);
+      CL_CHECK_ERROR(launch.upload(unit, 0));
 
-  cl_err = program.build({ device }, options.c_str());
-  if (cl_err != CL_SUCCESS) {
-    IF_LOGGING(cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)
-               << "\n");
-    CL_CHECK_ERROR(cl_err);
-  }
+      CL_CHECK_ERROR(launch.upload(unit, 1));
+      unit.timer.mark("write");
 
-  string kernel_str = "gaussian_blur";
-  cl::Kernel kernel(program, kernel_str.c_str(), &cl_err);
+      // the set_cunits binary only matches the first device
+      unit.load_program("gaussian",
+                        source_str,
+                        index ? vector<char>() : move(cunits.kernel_bin),
+                        use_binaries && !index);
 
-  cl_err = kernel.setArg(0, c_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 0");
+      launch.kernel = unit.kernel("gaussian", kernel_str);
+      auto& kernel = launch.kernel;
+      unit.timer.mark("build");
 
-  cl_err = kernel.setArg(1, a_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 1");
+      cl_err = kernel.setArg(0, c_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 0");
 
-  cl_err = kernel.setArg(2, image_height);
-  CL_CHECK_ERROR(cl_err, "kernel arg 2");
+      cl_err = kernel.setArg(1, a_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 1");
 
-  cl_err = kernel.setArg(3, image_width);
-  CL_CHECK_ERROR(cl_err, "kernel arg 3");
+      cl_err = kernel.setArg(2, image_height);
+      CL_CHECK_ERROR(cl_err, "kernel arg 2");
 
-  cl_err = kernel.setArg(4, b_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 1");
+      cl_err = kernel.setArg(3, image_width);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
 
-  cl_err = kernel.setArg(5, filter_width);
-  CL_CHECK_ERROR(cl_err, "kernel arg 3");
+      cl_err = kernel.setArg(4, b_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 1");
 
-  cl::UserEvent end(context, &cl_err);
-  CL_CHECK_ERROR(cl_err, "user event end");
+      cl_err = kernel.setArg(5, filter_width);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
 
-  cl::Event evkernel;
+      launch.offset_arg = 6;
+      unit.timer.mark("args");
+      return launch;
+    };
 
-  auto lws = 128;
+    // one work-item per output pixel
+    auto collect = [&](BaseSession& unit, BaseLaunch& launch, size_t offset, size_t size) {
+      return launch.download(unit, 2, offset * sizeof(cl_uchar4), size * sizeof(cl_uchar4));
+    };
 
-  auto offset = 0;
-  auto gws = size;
-  queue.enqueueNDRangeKernel(
-                             kernel, cl::NDRange(offset), cl::NDRange(gws), cl::NDRange(lws), NULL, NULL);
+    auto lws = 128;
+    auto gws = size;
 
-  cl::Event evread;
-  vector<cl::Event> events({ evkernel });
+    BaseCoexec coexec(session, tscheduler, chunksize, props);
+    coexec.tune_name = name;
+    coexec.run(gws, lws, setup, collect);
+  };
 
-  queue.enqueueReadBuffer(
-                          c_buffer, CL_TRUE, 0, sizeof(cl_uchar4) * c_array.get()->size(), c_array.get()->data());
+  size_t diff_ms = session.measure(name, measured);
 
-  auto t2 = std::chrono::system_clock::now().time_since_epoch();
-  size_t diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - time_init).count();
-
-  cout << "time: " << diff_ms << "\n";
-
-  string m_info_buffer;
-  m_info_buffer.reserve(128);
-  CL_CHECK_ERROR(platforms[sel_platform].getInfo(CL_PLATFORM_NAME, &m_info_buffer));
-
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected platform: " << m_info_buffer << "\n";
-  CL_CHECK_ERROR(device.getInfo(CL_DEVICE_NAME, &m_info_buffer));
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected device: " << m_info_buffer << "\n";
+  session.print_selected();
 
   cout << "program type: " << (use_binaries ? "binary" : "source") << "\n";
+  cout << "buffers: " << session.config.buffer_strategy << "\n";
   cout << "kernel: " << kernel_str << "\n";
-
-  auto in1 = *a_array.get();
-  auto in2 = *b_array.get();
-  auto out = *c_array.get();
+  cout << "mode: " << mode << " band rows: " << (band_rows ? band_rows : image_height) << "\n";
 
   if (check) {
-
-    auto ok = gaussian.compare_gaussian_blur();
+    // compare_gaussian_blur checks every mode and band layout. It only takes
+    // the whole image, so a sample is estimated with the 2d filter per pixel
+    // instead, within 1 for rounding
+    BaseVerify verify(session.config);
+    bool ok;
+    if (verify.sampling(size)) {
+      ok = verify.sampled(
+             size,
+             [&](size_t pixel) {
+               return base_gaussian_pixel_ok(
+                 gaussian, image_width, image_height, filter_width, pixel, 1.0f);
+             },
+             "pixels") == -1;
+    } else {
+      ok = verify.serial([&]() { return gaussian.compare_gaussian_blur(); });
+    }
+    verify.print();
 
     if (ok) {
       success(diff_ms);
@@ -194,10 +304,35 @@ do_gaussian_base(int tscheduler,
       failure(diff_ms);
     }
     if (check == 2) {
-      auto img = write_bmp_file(out.data(), image_width, image_height, "gaussian_base.bmp");
-      cout << "writing gaussian_base.bmp (" << img << ")\n";
+      // the writer takes over the output, nothing reads it after this
+      auto pixels = make_shared<vector<cl_uchar4>>(move(c_array));
+      base_write_image(
+        session.config, "gaussian_base.bmp", image_width, image_height, pixels->data(), pixels);
     }
   } else {
     cout << "Done\n";
   }
 }
+
+void
+do_gaussian_base(int tscheduler,
+                 int tdevices,
+                 uint check,
+                 uint image_width,
+                 int chunksize,
+                 bool use_binaries,
+                 vector<float>& props,
+                 uint filter_width)
+{
+  BaseSession session;
+  do_gaussian_base(
+    session,
+    tscheduler,
+    tdevices,
+    check,
+    image_width,
+    chunksize,
+    use_binaries,
+    props,
+    filter_width);
+}
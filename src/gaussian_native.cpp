@@ -0,0 +1,100 @@
+void
+do_gaussian_native(BaseSession& session,
+                   int tscheduler,
+                   int tdevices,
+                   uint check,
+                   uint image_width,
+                   int chunksize,
+                   bool use_binaries,
+                   vector<float>& props,
+                   uint filter_width)
+{
+  uint image_height = image_width;
+
+  IF_LOGGING(cout << image_width << "\n");
+
+  Gaussian gaussian(image_width, image_height, filter_width);
+
+  int size = gaussian._total_size;
+
+  // chunksize rows per block handed to a thread; tscheduler, tdevices,
+  // use_binaries and props only apply to devices
+  auto threads = base_native_threads(session.config);
+  size_t grain = chunksize > 0 ? chunksize : 4;
+
+  auto measured = [&]() {
+    session.timer.start();
+    base_native_for(threads, image_height, grain, [&](size_t begin, size_t end) {
+      base_native_gaussian(gaussian._c.data(),
+                           gaussian._a.data(),
+                           gaussian._b.data(),
+                           image_height,
+                           image_width,
+                           filter_width,
+                           begin,
+                           end);
+    });
+    session.timer.mark("compute");
+  };
+
+  size_t diff_ms = session.measure("gaussian_native", measured);
+
+  cout << "native: " << base_native_isa() << " threads " << threads << "\n";
+
+  if (check) {
+    // compare_gaussian_blur checks every mode and band layout. It only takes
+    // the whole image, so a sample is estimated with the 2d filter per pixel
+    // instead, within 1 for rounding
+    BaseVerify verify(session.config);
+    bool ok;
+    if (verify.sampling(size)) {
+      ok = verify.sampled(
+             size,
+             [&](size_t pixel) {
+               return base_gaussian_pixel_ok(
+                 gaussian, image_width, image_height, filter_width, pixel, 1.0f);
+             },
+             "pixels") == -1;
+    } else {
+      ok = verify.serial([&]() { return gaussian.compare_gaussian_blur(); });
+    }
+    verify.print();
+
+    if (ok) {
+      success(diff_ms);
+    } else {
+      failure(diff_ms);
+    }
+    if (check == 2) {
+      // the writer takes over the output, nothing reads it after this
+      auto pixels = make_shared<vector<cl_uchar4>>(move(gaussian._c));
+      base_write_image(
+        session.config, "gaussian_native.bmp", image_width, image_height, pixels->data(), pixels);
+    }
+  } else {
+    cout << "Done\n";
+  }
+}
+
+void
+do_gaussian_native(int tscheduler,
+                   int tdevices,
+                   uint check,
+                   uint image_width,
+                   int chunksize,
+                   bool use_binaries,
+                   vector<float>& props,
+                   uint filter_width)
+{
+  BaseSession session;
+  do_gaussian_native(
+    session,
+    tscheduler,
+    tdevices,
+    check,
+    image_width,
+    chunksize,
+    use_binaries,
+    props,
+    filter_width);
+}
@@ -1,5 +1,6 @@
 void
-do_mandelbrot_base(int tscheduler,
+do_mandelbrot_base(BaseSession& session,
+                   int tscheduler,
                    int tdevices,
                    uint check,
                    int chunksize,
@@ -13,13 +14,6 @@ do_mandelbrot_base(int tscheduler,
                    double ystep,
                    uint max_iterations)
 {
-  string source_str;
-  try {
-    source_str = file_read("support/kernels/mandelbrot.cl");
-  } catch (std::ios::failure& e) {
-    cout << "io failure: " << e.what() << "\n";
-  }
-
   // Make sure width is a multiple of 4
   width = (width + 3) & ~(4 - 1);
 
@@ -31,8 +25,6 @@ do_mandelbrot_base(int tscheduler,
   auto lws = 256;
   auto gws = size >> 2;
 
-  int worksize = chunksize;
-
   auto numDevices = 1;
   auto bench = 0;
   auto xsize = 4.0;
@@ -44,7 +36,7 @@ do_mandelbrot_base(int tscheduler,
     ypos = 0.3;
   }
 
-  auto out_array = make_shared<vector<cl_uchar4>>(size_matrix);
+  auto out_array = make_shared<base_vector<cl_uchar4>>(size_matrix);
   cl_uchar4* out_ptr = reinterpret_cast<cl_uchar4*>(out_array.get()->data());
 
   double aspect = (double)width / (double)height;
@@ -61,147 +53,177 @@ do_mandelbrot_base(int tscheduler,
   float xstepF = (float)xstep;
   float ystepF = (float)ystep;
 
-  auto sel_platform = PLATFORM;
-  auto sel_device = DEVICE;
-
-  CUnits cunits;
-  set_cunits(cunits, use_binaries, tdevices, "mandelbrot", true, false);
+  // Deep zoom: pixels are deltas from a high-precision center instead of float
+  // coordinates, which turn into blocks past ~1e-6 (see base_mandelbrot.hpp).
+  auto deep = !session.config.mandelbrot_center.empty();
+  string name = deep ? "mandelbrot_perturb" : "mandelbrot";
+  BaseDD center_x;
+  BaseDD center_y;
+  double dcx0 = 0.0;
+  double dcy0 = 0.0;
+  if (deep) {
+    auto center = base_mandelbrot_center(session.config.mandelbrot_center);
+    center_x = center.first;
+    center_y = center.second;
+    xsize = 4.0 / session.config.mandelbrot_zoom;
+    ysize = xsize / aspect;
+    xstep = xsize / width;
+    ystep = -ysize / height;
+    dcx0 = -xsize / 2.0;
+    dcy0 = ysize / 2.0;
+  }
+  base_vector<cl_float2> orbit;
+
+  string kernel_str = deep ? "mandelbrot_perturb" : "mandelbrot_vector_float";
+
+  auto measured = [&]() {
+    auto cold = !session.has_program(name);
+
+    string source_str;
+    CUnits cunits;
+    if (cold) {
+      try {
+        source_str = file_read("support/kernels/" + name + ".cl");
+      } catch (std::ios::failure& e) {
+        cout << "io failure: " << e.what() << "\n";
+      }
+      set_cunits(cunits, use_binaries, tdevices, name, true, false);
+    }
 
-  auto time_init = std::chrono::system_clock::now().time_since_epoch();
+    session.timer.start();
 
-  set_cunits(cunits, use_binaries, tdevices, "mandelbrot", false, false);
+    if (cold) {
+      set_cunits(cunits, use_binaries, tdevices, name, false, false);
+      session.timer.mark("set_cunits");
+      session.open(cunits);
+    }
 
-  vector<char> kernel_bin = move(cunits.kernel_bin);
+    if (deep) {
+      orbit = base_mandelbrot_orbit(center_x, center_y, max_iterations);
+      session.timer.mark("orbit");
+    }
 
-  sel_platform = cunits.sel_platform;
-  sel_device = cunits.sel_device;
+    auto setup = [&](BaseSession& unit, size_t index) {
+      cl_int cl_err = CL_SUCCESS;
 
-  vector<cl::Platform> platforms;
-  vector<vector<cl::Device>> platform_devices;
-  cl::Device device;
+      IF_LOGGING(cout << "initBuffers\n");
 
-  IF_LOGGING(cout << "discoverDevices\n");
-  cl::Platform::get(&platforms);
-  IF_LOGGING(cout << "platforms: " << platforms.size() << "\n");
-  auto i = 0;
-  for (auto& platform : platforms) {
-    vector<cl::Device> devices;
-    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    IF_LOGGING(cout << "platform: " << i++ << " devices: " << devices.size() << "\n");
-    platform_devices.push_back(move(devices));
-  }
+      cl_int buffer_in_flags = CL_MEM_READ_WRITE;
+      cl_int buffer_out_flags = CL_MEM_READ_WRITE;
 
-  auto last_platform = platforms.size() - 1;
-  if (sel_platform > last_platform) {
-    throw runtime_error("invalid platform selected");
-  }
+      IF_LOGGING(cout << out_array.get()->size() << "\n");
 
-  auto last_device = platform_devices[sel_platform].size() - 1;
-  if (sel_device > last_device) {
-    throw runtime_error("invalid device selected");
-  }
+      BaseLaunch launch;
+      launch.buffers.emplace_back(
+        unit, buffer_out_flags, sizeof(cl_uchar4) * out_array.get()->size(), out_ptr);
+      if (deep) {
+        launch.buffers.emplace_back(
+          unit, CL_MEM_READ_ONLY, sizeof(cl_float2) * orbit.size(), orbit.data());
+      }
+      auto& out_buffer = launch.buffers[0];
+      unit.timer.mark("buffers");
 
-  device = move(platform_devices[sel_platform][sel_device]);
+      if (deep) {
+        CL_CHECK_ERROR(launch.upload(unit, 1));
+        unit.timer.mark("write");
+      }
 
-  cl_int cl_err = CL_SUCCESS;
-  cl::Context context(device);
+      // the set_cunits binary only matches the first device
+      unit.load_program(name,
+                        source_str,
+                        index ? vector<char>() : move(cunits.kernel_bin),
+                        use_binaries && !index);
 
-  cl::CommandQueue queue(context, device, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "CommandQueue queue");
+      launch.kernel = unit.kernel(name, kernel_str);
+      auto& kernel = launch.kernel;
+      unit.timer.mark("build");
 
-  IF_LOGGING(cout << "initBuffers\n");
+      if (deep) {
+        cl_err = kernel.setArg(0, out_buffer.buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 0");
 
-  cl_int buffer_in_flags = CL_MEM_READ_WRITE;
-  cl_int buffer_out_flags = CL_MEM_READ_WRITE;
+        cl_err = kernel.setArg(1, launch.buffers[1].buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 1");
 
-  IF_LOGGING(cout << out_array.get()->size() << "\n");
+        cl_err = kernel.setArg(2, (cl_uint)orbit.size());
+        CL_CHECK_ERROR(cl_err, "kernel arg 2");
 
-  cl::Buffer out_buffer(
-                        context, buffer_out_flags, sizeof(cl_uchar4) * out_array.get()->size(), NULL);
-  CL_CHECK_ERROR(cl_err, "out buffer ");
+        cl_err = kernel.setArg(3, (cl_float)dcx0);
+        CL_CHECK_ERROR(cl_err, "kernel arg 3");
 
-  IF_LOGGING(cout << "initKernel\n");
+        cl_err = kernel.setArg(4, (cl_float)dcy0);
+        CL_CHECK_ERROR(cl_err, "kernel arg 4");
 
-  cl::Program::Sources sources;
-  cl::Program::Binaries binaries;
-  cl::Program program;
-  if (use_binaries) {
-    binaries.push_back({ kernel_bin.data(), kernel_bin.size() });
-    vector<cl_int> status = { -1 };
-    program = std::move(cl::Program(context, { device }, binaries, &status, &cl_err));
-    CL_CHECK_ERROR(cl_err, "building program from binary failed for device ");
-  } else {
-    sources.push_back({ source_str.c_str(), source_str.length() });
-    program = std::move(cl::Program(context, sources));
-  }
+        cl_err = kernel.setArg(5, (cl_float)xstep);
+        CL_CHECK_ERROR(cl_err, "kernel arg 5");
 
-  string options;
-  options.reserve(32);
-  options += "-DECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED=" +
-    to_string(ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED);
+        cl_err = kernel.setArg(6, (cl_float)ystep);
+        CL_CHECK_ERROR(cl_err, "kernel arg 6");
 
-  cl_err = program.build({ device }, options.c_str());
-  if (cl_err != CL_SUCCESS) {
-    IF_LOGGING(cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)
-               << "\n");
-    CL_CHECK_ERROR(cl_err);
-  }
+        cl_err = kernel.setArg(7, max_iterations);
+        CL_CHECK_ERROR(cl_err, "kernel arg 7");
 
-  string kernel_str = "mandelbrot_vector_float";
-  cl::Kernel kernel(program, kernel_str.c_str(), &cl_err);
+        cl_err = kernel.setArg(8, width);
+        CL_CHECK_ERROR(cl_err, "kernel arg 8");
 
-  cl_err = kernel.setArg(0, out_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 0");
+        launch.offset_arg = 9;
+        if (!ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED) {
+          cl_err = kernel.setArg(9, (cl_uint)0);
+          CL_CHECK_ERROR(cl_err, "kernel arg 9");
+        }
+        unit.timer.mark("args");
+        return launch;
+      }
 
-  cl_err = kernel.setArg(1, leftxF);
-  CL_CHECK_ERROR(cl_err, "kernel arg 1");
+      cl_err = kernel.setArg(0, out_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 0");
 
-  cl_err = kernel.setArg(2, topyF);
-  CL_CHECK_ERROR(cl_err, "kernel arg 2");
+      cl_err = kernel.setArg(1, leftxF);
+      CL_CHECK_ERROR(cl_err, "kernel arg 1");
 
-  cl_err = kernel.setArg(3, xstepF);
-  CL_CHECK_ERROR(cl_err, "kernel arg 3");
+      cl_err = kernel.setArg(2, topyF);
+      CL_CHECK_ERROR(cl_err, "kernel arg 2");
 
-  cl_err = kernel.setArg(4, ystepF);
-  CL_CHECK_ERROR(cl_err, "kernel arg 4");
+      cl_err = kernel.setArg(3, xstepF);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
 
-  cl_err = kernel.setArg(5, max_iterations);
-  CL_CHECK_ERROR(cl_err, "kernel arg 5");
+      cl_err = kernel.setArg(4, ystepF);
+      CL_CHECK_ERROR(cl_err, "kernel arg 4");
 
-  cl_err = kernel.setArg(6, width);
-  CL_CHECK_ERROR(cl_err, "kernel arg 6");
+      cl_err = kernel.setArg(5, max_iterations);
+      CL_CHECK_ERROR(cl_err, "kernel arg 5");
 
-  cl_err = kernel.setArg(7, bench);
-  CL_CHECK_ERROR(cl_err, "kernel arg 7");
+      cl_err = kernel.setArg(6, width);
+      CL_CHECK_ERROR(cl_err, "kernel arg 6");
 
-  auto offset = 0;
-  queue.enqueueNDRangeKernel(
-                             kernel, cl::NDRange(offset), cl::NDRange(gws), cl::NDRange(lws), NULL, NULL);
+      cl_err = kernel.setArg(7, bench);
+      CL_CHECK_ERROR(cl_err, "kernel arg 7");
 
-  queue.enqueueReadBuffer(
-                          out_buffer, CL_TRUE, 0, sizeof(cl_uchar4) * out_array.get()->size(), out_array.get()->data());
+      launch.offset_arg = 8;
+      unit.timer.mark("args");
+      return launch;
+    };
 
-  auto t2 = std::chrono::system_clock::now().time_since_epoch();
-  size_t diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - time_init).count();
+    // each work-item writes 4 consecutive pixels
+    auto collect = [&](BaseSession& unit, BaseLaunch& launch, size_t offset, size_t size) {
+      return launch.download(unit, 0, offset * 4 * sizeof(cl_uchar4), size * 4 * sizeof(cl_uchar4));
+    };
 
-  cout << "time: " << diff_ms << "\n";
+    BaseCoexec coexec(session, tscheduler, chunksize, props);
+    coexec.tune_name = name;
+    coexec.run(gws, lws, setup, collect);
+  };
 
-  string m_info_buffer;
-  m_info_buffer.reserve(128);
-  CL_CHECK_ERROR(platforms[sel_platform].getInfo(CL_PLATFORM_NAME, &m_info_buffer));
+  size_t diff_ms = session.measure(name, measured);
 
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected platform: " << m_info_buffer << "\n";
-  CL_CHECK_ERROR(device.getInfo(CL_DEVICE_NAME, &m_info_buffer));
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected device: " << m_info_buffer << "\n";
+  session.print_selected();
 
   cout << "program type: " << (use_binaries ? "binary" : "source") << "\n";
+  cout << "buffers: " << session.config.buffer_strategy << "\n";
   cout << "kernel: " << kernel_str << "\n";
-  auto out = *out_array.get();
-
+  if (deep) {
+    cout << "zoom: " << session.config.mandelbrot_zoom << " orbit: " << orbit.size() << "\n";
+  }
   if (ECL_LOGGING) {
     cout << "out:\n";
     for (uint i = 0; i < 10; ++i) {
@@ -219,8 +241,58 @@ do_mandelbrot_base(int tscheduler,
   if (check) {
     auto threshold = 0.001f;
 
-    auto ok = check_mandelbrot(
-                               out_ptr, leftxF, topyF, xstepF, ystepF, max_iterations, width, height, bench, threshold);
+    BaseVerify verify(session.config);
+    bool ok;
+    if (deep) {
+      ok = base_check_mandelbrot_perturb(verify,
+                                         out_ptr,
+                                         center_x,
+                                         center_y,
+                                         dcx0,
+                                         dcy0,
+                                         xstep,
+                                         ystep,
+                                         max_iterations,
+                                         width,
+                                         height,
+                                         threshold);
+    } else {
+      // check_mandelbrot, or a sample of pixels iterated on the host
+      if (verify.sampling(size_matrix)) {
+        auto pos = verify.sampled(
+          size_matrix,
+          [&](size_t pixel) {
+            return base_mandelbrot_pixel_matches(out_ptr,
+                                                 leftxF,
+                                                 topyF,
+                                                 xstepF,
+                                                 ystepF,
+                                                 max_iterations,
+                                                 width,
+                                                 bench,
+                                                 pixel % width,
+                                                 pixel / width);
+          },
+          "pixels");
+        if (pos != -1) {
+          cout << "first mismatch: pixel " << pos << "\n";
+        }
+        ok = verify.estimate_within("mandelbrot", threshold);
+      } else {
+        ok = base_check_mandelbrot(verify,
+                                   out_ptr,
+                                   leftxF,
+                                   topyF,
+                                   xstepF,
+                                   ystepF,
+                                   max_iterations,
+                                   width,
+                                   height,
+                                   bench,
+                                   threshold);
+      }
+    }
+    verify.print();
 
     if (ok) {
       success(diff_ms);
@@ -228,11 +300,49 @@ do_mandelbrot_base(int tscheduler,
       failure(diff_ms);
     }
     if (check == 2) {
-      transform_image(out.data(), width, height);
-      auto img = write_bmp_file(out.data(), width, height, "mandelbrot_base.bmp");
-      cout << "writing mandelbrot_base.bmp (" << img << ")\n";
+      // the image is not used after this, so the writer flips it in place
+      base_write_image(session.config,
+                       "mandelbrot_base.bmp",
+                       width,
+                       height,
+                       out_ptr,
+                       out_array,
+                       [=]() { transform_image(out_ptr, width, height); });
     }
   } else {
     cout << "Done\n";
   }
 }
+
+void
+do_mandelbrot_base(int tscheduler,
+                   int tdevices,
+                   uint check,
+                   int chunksize,
+                   bool use_binaries,
+                   vector<float>& props,
+                   int width,
+                   int height,
+                   double xpos,
+                   double ypos,
+                   double xstep,
+                   double ystep,
+                   uint max_iterations)
+{
+  BaseSession session;
+  do_mandelbrot_base(
+    session,
+    tscheduler,
+    tdevices,
+    check,
+    chunksize,
+    use_binaries,
+    props,
+    width,
+    height,
+    xpos,
+    ypos,
+    xstep,
+    ystep,
+    max_iterations);
+}
@@ -0,0 +1,224 @@
+void
+do_mandelbrot_native(BaseSession& session,
+                     int tscheduler,
+                     int tdevices,
+                     uint check,
+                     int chunksize,
+                     bool use_binaries,
+                     vector<float>& props,
+                     int width,
+                     int height,
+                     double xpos,
+                     double ypos,
+                     double xstep,
+                     double ystep,
+                     uint max_iterations)
+{
+  // Make sure width is a multiple of 4
+  width = (width + 3) & ~(4 - 1);
+
+  IF_LOGGING(cout << width << " h " << height << "\n");
+
+  int size_matrix = width * height;
+
+  auto bench = 0;
+  auto xsize = 4.0;
+
+  auto larger = true; // the set is larger than the default
+  if (larger) {
+    xsize = 4 * xsize / 7;
+    xpos = -0.65;
+    ypos = 0.3;
+  }
+
+  auto out_array = make_shared<base_vector<cl_uchar4>>(size_matrix);
+  cl_uchar4* out_ptr = reinterpret_cast<cl_uchar4*>(out_array.get()->data());
+
+  double aspect = (double)width / (double)height;
+  xstep = (xsize / (double)width);
+  // Adjust for aspect ratio
+  double ysize = xsize / aspect;
+  ystep = (-(xsize / aspect) / height);
+  auto leftx = (xpos - xsize / 2.0);
+  auto topy = (ypos + ysize / 2.0);
+
+  float leftxF = (float)leftx;
+  float topyF = (float)topy;
+  float xstepF = (float)xstep;
+  float ystepF = (float)ystep;
+
+  // Deep zoom iterates the double deltas of the perturbation check directly
+  // (see base_mandelbrot.hpp), one pixel at a time.
+  auto deep = !session.config.mandelbrot_center.empty();
+  string name = deep ? "mandelbrot_perturb_native" : "mandelbrot_native";
+  BaseDD center_x;
+  BaseDD center_y;
+  double dcx0 = 0.0;
+  double dcy0 = 0.0;
+  if (deep) {
+    auto center = base_mandelbrot_center(session.config.mandelbrot_center);
+    center_x = center.first;
+    center_y = center.second;
+    xsize = 4.0 / session.config.mandelbrot_zoom;
+    ysize = xsize / aspect;
+    xstep = xsize / width;
+    ystep = -ysize / height;
+    dcx0 = -xsize / 2.0;
+    dcy0 = ysize / 2.0;
+  }
+  base_vector<cl_float2> orbit;
+
+  // chunksize rows per block handed to a thread; tscheduler, tdevices,
+  // use_binaries and props only apply to devices
+  auto threads = base_native_threads(session.config);
+  size_t grain = chunksize > 0 ? chunksize : 4;
+
+  auto measured = [&]() {
+    session.timer.start();
+
+    if (deep) {
+      orbit = base_mandelbrot_orbit(center_x, center_y, max_iterations);
+      session.timer.mark("orbit");
+
+      base_native_for(threads, height, grain, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+          for (int x = 0; x < width; ++x) {
+            auto iter = base_mandelbrot_perturb(
+              orbit, dcx0 + x * xstep, dcy0 + y * ystep, max_iterations);
+            out_ptr[y * width + x] = base_mandelbrot_color(iter, max_iterations);
+          }
+        }
+      });
+      session.timer.mark("compute");
+      return;
+    }
+
+    base_native_for(threads, height, grain, [&](size_t begin, size_t end) {
+      base_native_mandelbrot(out_ptr + begin * width,
+                             leftxF,
+                             topyF,
+                             xstepF,
+                             ystepF,
+                             max_iterations,
+                             width,
+                             bench,
+                             begin,
+                             end);
+    });
+    session.timer.mark("compute");
+  };
+
+  size_t diff_ms = session.measure(name, measured);
+
+  cout << "native: " << base_native_isa() << " threads " << threads << "\n";
+  if (deep) {
+    cout << "zoom: " << session.config.mandelbrot_zoom << " orbit: " << orbit.size() << "\n";
+  }
+
+  if (check) {
+    auto threshold = 0.001f;
+
+    BaseVerify verify(session.config);
+    bool ok;
+    if (deep) {
+      ok = base_check_mandelbrot_perturb(verify,
+                                         out_ptr,
+                                         center_x,
+                                         center_y,
+                                         dcx0,
+                                         dcy0,
+                                         xstep,
+                                         ystep,
+                                         max_iterations,
+                                         width,
+                                         height,
+                                         threshold);
+    } else {
+      // a sampled row is checked as an image of its own, the full check is
+      // base_check_mandelbrot
+      auto check_band = [&](size_t begin, size_t end) -> long {
+        auto band_ok = check_mandelbrot(out_ptr + begin * width,
+                                        leftxF,
+                                        topyF + begin * ystepF,
+                                        xstepF,
+                                        ystepF,
+                                        max_iterations,
+                                        width,
+                                        end - begin,
+                                        bench,
+                                        threshold);
+        return band_ok ? -1 : begin;
+      };
+      if (verify.sampling(height)) {
+        // check_mandelbrot works on whole rows, so rows are sampled and the
+        // reported bound is per row
+        auto pos = verify.sampled(
+          height, [&](size_t row) { return check_band(row, row + 1) == -1; }, "rows");
+        ok = pos == -1;
+      } else {
+        ok = base_check_mandelbrot(verify,
+                                   out_ptr,
+                                   leftxF,
+                                   topyF,
+                                   xstepF,
+                                   ystepF,
+                                   max_iterations,
+                                   width,
+                                   height,
+                                   bench,
+                                   threshold);
+      }
+    }
+    verify.print();
+
+    if (ok) {
+      success(diff_ms);
+    } else {
+      failure(diff_ms);
+    }
+    if (check == 2) {
+      // the image is not used after this, so the writer flips it in place
+      base_write_image(session.config,
+                       "mandelbrot_native.bmp",
+                       width,
+                       height,
+                       out_ptr,
+                       out_array,
+                       [=]() { transform_image(out_ptr, width, height); });
+    }
+  } else {
+    cout << "Done\n";
+  }
+}
+
+void
+do_mandelbrot_native(int tscheduler,
+                     int tdevices,
+                     uint check,
+                     int chunksize,
+                     bool use_binaries,
+                     vector<float>& props,
+                     int width,
+                     int height,
+                     double xpos,
+                     double ypos,
+                     double xstep,
+                     double ystep,
+                     uint max_iterations)
+{
+  BaseSession session;
+  do_mandelbrot_native(session,
+                       tscheduler,
+                       tdevices,
+                       check,
+                       chunksize,
+                       use_binaries,
+                       props,
+                       width,
+                       height,
+                       xpos,
+                       ypos,
+                       xstep,
+                       ystep,
+                       max_iterations);
+}
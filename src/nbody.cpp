@@ -1,5 +1,6 @@
 void
-do_nbody_base(int tscheduler,
+do_nbody_base(BaseSession& session,
+              int tscheduler,
               int tdevices,
               uint check,
               uint num_particles,
@@ -12,19 +13,15 @@ do_nbody_base(int tscheduler,
   cl_float delT = DEL_T;
   cl_float espSqr = ESP_SQR;
 
-  int worksize = chunksize;
-
-  string source_str = file_read("support/kernels/nbody.cl");
-
   num_particles = (uint)(((size_t)num_particles < group_size) ? group_size : num_particles);
   num_particles = (uint)((num_particles / group_size) * group_size);
 
   uint num_bodies = num_particles;
 
-  auto pos_in_array = make_shared<vector<cl_float4>>(num_bodies);
-  auto vel_in_array = make_shared<vector<cl_float4>>(num_bodies);
-  auto pos_out_array = make_shared<vector<cl_float4>>(num_bodies);
-  auto vel_out_array = make_shared<vector<cl_float4>>(num_bodies);
+  auto pos_in_array = make_shared<base_vector<cl_float4>>(num_bodies);
+  auto vel_in_array = make_shared<base_vector<cl_float4>>(num_bodies);
+  auto pos_out_array = make_shared<base_vector<cl_float4>>(num_bodies);
+  auto vel_out_array = make_shared<base_vector<cl_float4>>(num_bodies);
 
   cl_float4* pos_in_ptr = reinterpret_cast<cl_float4*>(pos_in_array.get()->data());
   cl_float4* vel_in_ptr = reinterpret_cast<cl_float4*>(vel_in_array.get()->data());
@@ -36,199 +33,285 @@ do_nbody_base(int tscheduler,
   float* pos_out = reinterpret_cast<float*>(pos_out_ptr);
   float* vel_out = reinterpret_cast<float*>(vel_out_ptr);
 
-  srand(0);
-  for (uint i = 0; i < num_bodies; ++i) {
-    int index = 4 * i;
-
-    // First 3 values are position in x,y and z direction
-    for (int j = 0; j < 3; ++j) {
-      pos_in[index + j] = random(3, 50);
-    }
-
-    // Mass value
-    pos_in[index + 3] = random(1, 1000);
-
-    for (int j = 0; j < 4; ++j) {
-      // init to 0
-      vel_in[index + j] = 0.0f;
+  // positions in [3, 50), masses in [1, 1000), velocities 0
+  if (base_random_philox(session.config)) {
+    base_random_fill(session.config, 1, num_bodies, [&](size_t i, array<float, 4> u) {
+      for (int j = 0; j < 3; ++j) {
+        pos_in[4 * i + j] = 3.0f + 47.0f * u[j];
+        vel_in[4 * i + j] = 0.0f;
+      }
+      pos_in[4 * i + 3] = 1.0f + 999.0f * u[3];
+      vel_in[4 * i + 3] = 0.0f;
+    });
+  } else {
+    srand(0);
+    for (uint i = 0; i < num_bodies; ++i) {
+      int index = 4 * i;
+
+      // First 3 values are position in x,y and z direction
+      for (int j = 0; j < 3; ++j) {
+        pos_in[index + j] = random(3, 50);
+      }
+
+      // Mass value
+      pos_in[index + 3] = random(1, 1000);
+
+      for (int j = 0; j < 4; ++j) {
+        // init to 0
+        vel_in[index + j] = 0.0f;
+      }
     }
   }
 
   auto lws = group_size;
   auto gws = num_bodies;
 
-  auto sel_platform = PLATFORM;
-  auto sel_device = DEVICE;
-
-  CUnits cunits;
-  set_cunits(cunits, use_binaries, tdevices, "nbody", true, false);
-
-  auto time_init = std::chrono::system_clock::now().time_since_epoch();
-
-  set_cunits(cunits, use_binaries, tdevices, "nbody", false, false);
-
-  vector<char> kernel_bin = move(cunits.kernel_bin);
-
-  sel_platform = cunits.sel_platform;
-  sel_device = cunits.sel_device;
-
-  vector<cl::Platform> platforms;
-  vector<vector<cl::Device>> platform_devices;
-  cl::Device device;
-
-  IF_LOGGING(cout << "discoverDevices\n");
-  cl::Platform::get(&platforms);
-  IF_LOGGING(cout << "platforms: " << platforms.size() << "\n");
-  auto i = 0;
-  for (auto& platform : platforms) {
-    vector<cl::Device> devices;
-    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    IF_LOGGING(cout << "platform: " << i++ << " devices: " << devices.size() << "\n");
-    platform_devices.push_back(move(devices));
+  if (ECL_LOGGING) {
+    cout << "pos in:\n";
+    for (uint i = 0; i < 10; ++i) {
+      cout << pos_in_ptr[i] << " ";
+    }
+    cout << "\n";
+    for (uint i = num_bodies - 10; i < num_bodies; ++i) {
+      cout << pos_in_ptr[i] << " ";
+    }
+    cout << "\n";
+    cout << "vel in:\n";
+    for (uint i = 0; i < 10; ++i) {
+      cout << vel_in_ptr[i] << " ";
+    }
+    cout << "\n";
+    for (uint i = num_bodies - 10; i < num_bodies; ++i) {
+      cout << vel_in_ptr[i] << " ";
+    }
+    cout << "\n";
   }
 
-  auto last_platform = platforms.size() - 1;
-  if (sel_platform > last_platform) {
-    throw runtime_error("invalid platform selected");
-  }
+  string kernel_str = "nbody_sim";
 
-  auto last_device = platform_devices[sel_platform].size() - 1;
-  if (sel_device > last_device) {
-    throw runtime_error("invalid device selected");
+  // Multi-step mode: the state stays on the device and the in/out buffer pairs
+  // swap roles every step, so the host arrays of both pairs get overwritten.
+  auto steps = session.config.nbody_steps;
+  auto snapshot = session.config.nbody_snapshot;
+  auto check_step = session.config.nbody_check_step ? session.config.nbody_check_step : steps;
+  if (check_step > steps) {
+    throw runtime_error("nbody check step beyond the last step");
   }
+  base_vector<cl_float4> pos_init;
+  base_vector<cl_float4> vel_init;
+  vector<cl_float4> check_pos_in;
+  vector<cl_float4> check_vel_in;
+  vector<cl_float4> check_pos_out;
+  vector<cl_float4> check_vel_out;
+  if (steps > 1) {
+    pos_init.assign(pos_in_ptr, pos_in_ptr + num_bodies);
+    vel_init.assign(vel_in_ptr, vel_in_ptr + num_bodies);
+  }
+  cl_float4* final_pos_ptr = pos_out_ptr;
+  cl_float4* final_vel_ptr = vel_out_ptr;
+  size_t snapshots = 0;
+  BaseStats step_stats;
+
+  auto measured = [&]() {
+    auto cold = !session.has_program("nbody");
+
+    string source_str;
+    CUnits cunits;
+    if (cold) {
+      source_str = file_read("support/kernels/nbody.cl");
+      set_cunits(cunits, use_binaries, tdevices, "nbody", true, false);
+    }
+    if (steps > 1) {
+      // the previous run stepped over the inputs
+      copy(pos_init.begin(), pos_init.end(), pos_in_ptr);
+      copy(vel_init.begin(), vel_init.end(), vel_in_ptr);
+    }
 
-  device = move(platform_devices[sel_platform][sel_device]);
-
-  cl_int cl_err = CL_SUCCESS;
-  cl::Context context(device);
+    session.timer.start();
 
-  cl::CommandQueue queue(context, device, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "CommandQueue queue");
+    if (cold) {
+      set_cunits(cunits, use_binaries, tdevices, "nbody", false, false);
+      session.timer.mark("set_cunits");
+      session.open(cunits);
+    }
 
-  IF_LOGGING(cout << "initBuffers\n");
+    size_t buffer_size = num_bodies * sizeof(cl_float4);
 
-  cl_int buffer_in_flags = CL_MEM_READ_WRITE;
-  cl_int buffer_out_flags = CL_MEM_READ_WRITE;
+    auto setup = [&](BaseSession& unit, size_t index) {
+      cl_int cl_err = CL_SUCCESS;
 
-  size_t buffer_size = num_bodies * sizeof(cl_float4);
+      IF_LOGGING(cout << "initBuffers\n");
 
-  cl::Buffer pos_in_buffer(context, buffer_in_flags, buffer_size, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "pos in1 buffer ");
-  cl::Buffer pos_out_buffer(context, buffer_out_flags, buffer_size, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "pos out1 buffer ");
-  cl::Buffer vel_in_buffer(context, buffer_in_flags, buffer_size, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "vel in1 buffer ");
-  cl::Buffer vel_out_buffer(context, buffer_out_flags, buffer_size, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "vel out1 buffer ");
+      cl_int buffer_in_flags = CL_MEM_READ_WRITE;
+      cl_int buffer_out_flags = CL_MEM_READ_WRITE;
 
-  IF_LOGGING(cout << "x\n");
-  CL_CHECK_ERROR(
-                 queue.enqueueWriteBuffer(pos_in_buffer, CL_FALSE, 0, buffer_size, pos_in_ptr, NULL, NULL));
+      BaseLaunch launch;
+      launch.buffers.emplace_back(unit, buffer_in_flags, buffer_size, pos_in_ptr);
+      launch.buffers.emplace_back(unit, buffer_out_flags, buffer_size, pos_out_ptr);
+      launch.buffers.emplace_back(unit, buffer_in_flags, buffer_size, vel_in_ptr);
+      launch.buffers.emplace_back(unit, buffer_out_flags, buffer_size, vel_out_ptr);
+      auto& pos_in_buffer = launch.buffers[0];
+      auto& pos_out_buffer = launch.buffers[1];
+      auto& vel_in_buffer = launch.buffers[2];
+      auto& vel_out_buffer = launch.buffers[3];
+      unit.timer.mark("buffers");
 
-  CL_CHECK_ERROR(
-                 queue.enqueueWriteBuffer(vel_in_buffer, CL_FALSE, 0, buffer_size, vel_in_ptr, NULL, NULL));
+      IF_LOGGING(cout << "x\n");
+      CL_CHECK_ERROR(launch.upload(unit, 0));
 
-  IF_LOGGING(cout << "initKernel\n");
+      CL_CHECK_ERROR(launch.upload(unit, 2));
+      unit.timer.mark("write");
 
-  cl::Program::Sources sources;
-  cl::Program::Binaries binaries;
-  cl::Program program;
-  if (use_binaries) {
-    binaries.push_back({ kernel_bin.data(), kernel_bin.size() });
-    vector<cl_int> status = { -1 };
-    program = std::move(cl::Program(context, { device }, binaries, &status, &cl_err));
-    CL_CHECK_ERROR(cl_err, "building program from binary failed for device ");
-  } else {
-    sources.push_back({ source_str.c_str(), source_str.length() });
-    program = std::move(cl::Program(context, sources));
-  }
+      // the set_cunits binary only matches the first device
+      unit.load_program("nbody",
+                        source_str,
+                        index ? vector<char>() : move(cunits.kernel_bin),
+                        use_binaries && !index);
 
-  string options;
-  options.reserve(32);
-  options += "-DECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED=" +
-    to_string(ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED);
+      launch.kernel = unit.kernel("nbody", kernel_str);
+      auto& kernel = launch.kernel;
+      unit.timer.mark("build");
 
-  cl_err = program.build({ device }, options.c_str());
-  if (cl_err != CL_SUCCESS) {
-    IF_LOGGING(cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)
-               << "\n");
-    CL_CHECK_ERROR(cl_err);
-  }
+      cl_err = kernel.setArg(0, pos_in_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 0");
 
-  string kernel_str = "nbody_sim";
-  cl::Kernel kernel(program, kernel_str.c_str(), &cl_err);
+      cl_err = kernel.setArg(1, vel_in_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 1");
 
-  cl_err = kernel.setArg(0, pos_in_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 0");
+      cl_err = kernel.setArg(2, num_bodies);
+      CL_CHECK_ERROR(cl_err, "kernel arg 2");
 
-  cl_err = kernel.setArg(1, vel_in_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 1");
+      cl_err = kernel.setArg(3, delT);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
 
-  cl_err = kernel.setArg(2, num_bodies);
-  CL_CHECK_ERROR(cl_err, "kernel arg 2");
+      cl_err = kernel.setArg(4, espSqr);
+      CL_CHECK_ERROR(cl_err, "kernel arg 4");
 
-  cl_err = kernel.setArg(3, delT);
-  CL_CHECK_ERROR(cl_err, "kernel arg 3");
+      cl_err = kernel.setArg(5, pos_out_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 5");
 
-  cl_err = kernel.setArg(4, espSqr);
-  CL_CHECK_ERROR(cl_err, "kernel arg 4");
+      cl_err = kernel.setArg(6, vel_out_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 6");
 
-  cl_err = kernel.setArg(5, pos_out_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 5");
+      launch.offset_arg = 7;
+      unit.timer.mark("args");
+      return launch;
+    };
 
-  cl_err = kernel.setArg(6, vel_out_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 6");
+    // one work-item per body, every device reads all positions
+    auto collect = [&](BaseSession& unit, BaseLaunch& launch, size_t offset, size_t size) {
+      auto cl_err =
+        launch.download(unit, 1, offset * sizeof(cl_float4), size * sizeof(cl_float4));
+      if (cl_err != CL_SUCCESS) {
+        return cl_err;
+      }
+      return launch.download(unit, 3, offset * sizeof(cl_float4), size * sizeof(cl_float4));
+    };
 
-  if (ECL_LOGGING) {
-    cout << "pos in:\n";
-    for (uint i = 0; i < 10; ++i) {
-      cout << pos_in_ptr[i] << " ";
-    }
-    cout << "\n";
-    for (uint i = num_bodies - 10; i < num_bodies; ++i) {
-      cout << pos_in_ptr[i] << " ";
-    }
-    cout << "\n";
-    cout << "vel in:\n";
-    for (uint i = 0; i < 10; ++i) {
-      cout << vel_in_ptr[i] << " ";
-    }
-    cout << "\n";
-    for (uint i = num_bodies - 10; i < num_bodies; ++i) {
-      cout << vel_in_ptr[i] << " ";
+    if (steps == 1) {
+      BaseCoexec coexec(session, tscheduler, chunksize, props);
+      coexec.tune_name = "nbody";
+      coexec.run(gws, lws, setup, collect);
+      return;
     }
-    cout << "\n";
-  }
-
-  auto offset = 0;
-  queue.enqueueNDRangeKernel(
-                             kernel, cl::NDRange(offset), cl::NDRange(gws), cl::NDRange(lws), NULL, NULL);
 
-  CL_CHECK_ERROR(
-                 queue.enqueueReadBuffer(pos_out_buffer, CL_TRUE, 0, buffer_size, pos_out_ptr, NULL, NULL));
-  CL_CHECK_ERROR(
-                 queue.enqueueReadBuffer(vel_out_buffer, CL_TRUE, 0, buffer_size, vel_out_ptr, NULL, NULL));
-
-  auto t2 = std::chrono::system_clock::now().time_since_epoch();
-  size_t diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - time_init).count();
+    // every step reads all positions of the previous one
+    if (session.units().size() > 1) {
+      throw runtime_error("nbody steps need a single device");
+    }
 
-  cout << "time: " << diff_ms << "\n";
+    auto launch = setup(session, 0);
+    CL_CHECK_ERROR(launch.sync(session), "barrier");
+    auto step_lws = base_tuned_lws(session, "nbody", launch.kernel, gws, lws);
+    auto& kernel = launch.kernel;
+    auto& queue = session.queue;
+    cl_int cl_err = CL_SUCCESS;
+
+    snapshots = 0;
+    auto step_init = std::chrono::steady_clock::now();
+    for (long step = 1; step <= steps; ++step) {
+      // odd steps read pair 0/2 (in) and write 1/3 (out), even steps the reverse
+      auto even = step % 2 == 0;
+      auto& pos_src = launch.buffers[even ? 1 : 0];
+      auto& pos_dst = launch.buffers[even ? 0 : 1];
+      auto& vel_src = launch.buffers[even ? 3 : 2];
+      auto& vel_dst = launch.buffers[even ? 2 : 3];
+
+      if (step > 1) {
+        cl_err = kernel.setArg(0, pos_src.buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 0");
+        cl_err = kernel.setArg(1, vel_src.buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 1");
+        cl_err = kernel.setArg(5, pos_dst.buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 5");
+        cl_err = kernel.setArg(6, vel_dst.buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 6");
+        session.timer.mark("args");
+      }
+
+      if (check && step == check_step) {
+        CL_CHECK_ERROR(pos_src.download(queue));
+        CL_CHECK_ERROR(vel_src.download(queue));
+        check_pos_in.assign(static_cast<cl_float4*>(pos_src.host_ptr),
+                            static_cast<cl_float4*>(pos_src.host_ptr) + num_bodies);
+        check_vel_in.assign(static_cast<cl_float4*>(vel_src.host_ptr),
+                            static_cast<cl_float4*>(vel_src.host_ptr) + num_bodies);
+        session.timer.mark("check");
+      }
+
+      cl_err = queue.enqueueNDRangeKernel(kernel,
+                                          cl::NDRange(0),
+                                          cl::NDRange(gws),
+                                          cl::NDRange(step_lws),
+                                          NULL,
+                                          session.event("kernel", queue));
+      CL_CHECK_ERROR(cl_err, "enqueue kernel");
+      session.timer.mark("launch");
+
+      auto is_snapshot = step == steps || (snapshot && step % snapshot == 0);
+      if (is_snapshot || (check && step == check_step)) {
+        CL_CHECK_ERROR(pos_dst.download(queue));
+        CL_CHECK_ERROR(vel_dst.download(queue));
+        session.timer.mark("read");
+        snapshots++;
+        final_pos_ptr = static_cast<cl_float4*>(pos_dst.host_ptr);
+        final_vel_ptr = static_cast<cl_float4*>(vel_dst.host_ptr);
+      }
+
+      if (check && step == check_step) {
+        check_pos_out.assign(final_pos_ptr, final_pos_ptr + num_bodies);
+        check_vel_out.assign(final_vel_ptr, final_vel_ptr + num_bodies);
+        session.timer.mark("check");
+      }
+    }
+    auto step_end = std::chrono::steady_clock::now();
+    step_stats.add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(step_end - step_init).count());
+    session.timer.count("snapshots", snapshots);
+  };
 
-  string m_info_buffer;
-  m_info_buffer.reserve(128);
-  CL_CHECK_ERROR(platforms[sel_platform].getInfo(CL_PLATFORM_NAME, &m_info_buffer));
+  size_t diff_ms = session.measure("nbody", measured);
 
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected platform: " << m_info_buffer << "\n";
-  CL_CHECK_ERROR(device.getInfo(CL_DEVICE_NAME, &m_info_buffer));
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected device: " << m_info_buffer << "\n";
+  session.print_selected();
 
   cout << "program type: " << (use_binaries ? "binary" : "source") << "\n";
+  cout << "buffers: " << session.config.buffer_strategy << "\n";
   cout << "kernel: " << kernel_str << "\n";
 
+  if (steps > 1) {
+    // warmup runs are not part of the rates
+    step_stats.samples.erase(step_stats.samples.begin(),
+                             step_stats.samples.begin() + session.config.warmup);
+    auto step_s = step_stats.median() / 1e9;
+    cout << "steps: " << steps << " snapshot: " << snapshot << " snapshots: " << snapshots
+         << "\n";
+    cout << "steps/s: " << (step_s > 0 ? steps / step_s : 0.0) << "\n";
+    cout << "interactions/s: "
+         << (step_s > 0 ? (double)steps * num_bodies * num_bodies / step_s : 0.0) << "\n";
+    pos_out_ptr = final_pos_ptr;
+    vel_out_ptr = final_vel_ptr;
+  }
+
   if (ECL_LOGGING) {
     cout << "pos out:\n";
     for (uint i = 0; i < 10; ++i) {
@@ -251,7 +334,18 @@ do_nbody_base(int tscheduler,
   }
   if (check) {
     auto threshold = 0.001f;
-    auto ok = do_nbody_check(num_bodies, delT, espSqr, pos_in, vel_in, pos_out, vel_out, threshold);
+    if (steps > 1) {
+      // one step from the device state of the check step's input
+      cout << "check step: " << check_step << "\n";
+      pos_in = reinterpret_cast<float*>(check_pos_in.data());
+      vel_in = reinterpret_cast<float*>(check_vel_in.data());
+      pos_out = reinterpret_cast<float*>(check_pos_out.data());
+      vel_out = reinterpret_cast<float*>(check_vel_out.data());
+    }
+    BaseVerify verify(session.config);
+    auto ok = base_check_nbody(
+      verify, num_bodies, delT, espSqr, pos_in, vel_in, pos_out, vel_out, threshold);
+    verify.print();
 
     if (ok) {
       success(diff_ms);
@@ -262,3 +356,17 @@ do_nbody_base(int tscheduler,
     cout << "Done\n";
   }
 }
+
+void
+do_nbody_base(int tscheduler,
+              int tdevices,
+              uint check,
+              uint num_particles,
+              int chunksize,
+              bool use_binaries,
+              vector<float>& props)
+{
+  BaseSession session;
+  do_nbody_base(
+    session, tscheduler, tdevices, check, num_particles, chunksize, use_binaries, props);
+}
@@ -0,0 +1,181 @@
+void
+do_nbody_native(BaseSession& session,
+                int tscheduler,
+                int tdevices,
+                uint check,
+                uint num_particles,
+                int chunksize,
+                bool use_binaries,
+                vector<float>& props)
+{
+  auto group_size = GROUP_SIZE;
+
+  cl_float delT = DEL_T;
+  cl_float espSqr = ESP_SQR;
+
+  num_particles = (uint)(((size_t)num_particles < group_size) ? group_size : num_particles);
+  num_particles = (uint)((num_particles / group_size) * group_size);
+
+  uint num_bodies = num_particles;
+
+  base_vector<cl_float4> pos_init(num_bodies);
+  base_vector<cl_float4> vel_init(num_bodies);
+
+  float* pos_in = reinterpret_cast<float*>(pos_init.data());
+  float* vel_in = reinterpret_cast<float*>(vel_init.data());
+
+  // positions in [3, 50), masses in [1, 1000), velocities 0
+  if (base_random_philox(session.config)) {
+    base_random_fill(session.config, 1, num_bodies, [&](size_t i, array<float, 4> u) {
+      for (int j = 0; j < 3; ++j) {
+        pos_in[4 * i + j] = 3.0f + 47.0f * u[j];
+        vel_in[4 * i + j] = 0.0f;
+      }
+      pos_in[4 * i + 3] = 1.0f + 999.0f * u[3];
+      vel_in[4 * i + 3] = 0.0f;
+    });
+  } else {
+    srand(0);
+    for (uint i = 0; i < num_bodies; ++i) {
+      int index = 4 * i;
+
+      // First 3 values are position in x,y and z direction
+      for (int j = 0; j < 3; ++j) {
+        pos_in[index + j] = random(3, 50);
+      }
+
+      // Mass value
+      pos_in[index + 3] = random(1, 1000);
+
+      for (int j = 0; j < 4; ++j) {
+        // init to 0
+        vel_in[index + j] = 0.0f;
+      }
+    }
+  }
+
+  // Time steps ping-pong between two host states like the device buffer pairs
+  // of do_nbody_base; the check step's input and output are kept aside.
+  auto steps = session.config.nbody_steps;
+  auto check_step = session.config.nbody_check_step ? session.config.nbody_check_step : steps;
+  if (check_step > steps) {
+    throw runtime_error("nbody check step beyond the last step");
+  }
+  base_vector<cl_float4> pos_state[2] = { base_vector<cl_float4>(num_bodies),
+                                          base_vector<cl_float4>(num_bodies) };
+  base_vector<cl_float4> vel_state[2] = { base_vector<cl_float4>(num_bodies),
+                                          base_vector<cl_float4>(num_bodies) };
+  vector<cl_float4> check_pos_in;
+  vector<cl_float4> check_vel_in;
+  vector<cl_float4> check_pos_out;
+  vector<cl_float4> check_vel_out;
+  BaseStats step_stats;
+
+  // chunksize bodies per block handed to a thread; tscheduler, tdevices,
+  // use_binaries and props only apply to devices
+  auto threads = base_native_threads(session.config);
+  size_t grain = chunksize > 0 ? chunksize : group_size;
+
+  auto step_bodies = [&](const float* pos, const float* vel, float* pos_next, float* vel_next) {
+    BaseNbodyReference soa(pos, num_bodies);
+    base_native_for(threads, num_bodies, grain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        float acc[3];
+        base_nbody_accel(
+          soa.x.data(), soa.y.data(), soa.z.data(), soa.m.data(), num_bodies, i, espSqr, acc);
+        for (int c = 0; c < 3; ++c) {
+          auto v = vel[4 * i + c];
+          pos_next[4 * i + c] = pos[4 * i + c] + v * delT + acc[c] * 0.5f * delT * delT;
+          vel_next[4 * i + c] = v + acc[c] * delT;
+        }
+        pos_next[4 * i + 3] = pos[4 * i + 3];
+        vel_next[4 * i + 3] = vel[4 * i + 3];
+      }
+    });
+  };
+
+  auto measured = [&]() {
+    // the previous run stepped over the inputs
+    copy(pos_init.begin(), pos_init.end(), pos_state[0].begin());
+    copy(vel_init.begin(), vel_init.end(), vel_state[0].begin());
+
+    session.timer.start();
+
+    auto step_init = std::chrono::steady_clock::now();
+    for (long step = 1; step <= steps; ++step) {
+      // odd steps read state 0 and write state 1, even steps the reverse
+      auto src = step % 2 == 0 ? 1 : 0;
+      auto pos_src = reinterpret_cast<float*>(pos_state[src].data());
+      auto vel_src = reinterpret_cast<float*>(vel_state[src].data());
+      auto pos_dst = reinterpret_cast<float*>(pos_state[1 - src].data());
+      auto vel_dst = reinterpret_cast<float*>(vel_state[1 - src].data());
+
+      if (check && step == check_step) {
+        check_pos_in.assign(pos_state[src].begin(), pos_state[src].end());
+        check_vel_in.assign(vel_state[src].begin(), vel_state[src].end());
+        session.timer.mark("check");
+      }
+
+      step_bodies(pos_src, vel_src, pos_dst, vel_dst);
+      session.timer.mark("compute");
+
+      if (check && step == check_step) {
+        check_pos_out.assign(pos_state[1 - src].begin(), pos_state[1 - src].end());
+        check_vel_out.assign(vel_state[1 - src].begin(), vel_state[1 - src].end());
+        session.timer.mark("check");
+      }
+    }
+    auto step_end = std::chrono::steady_clock::now();
+    step_stats.add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(step_end - step_init).count());
+  };
+
+  size_t diff_ms = session.measure("nbody_native", measured);
+
+  cout << "native: " << base_native_isa() << " threads " << threads << "\n";
+
+  // warmup runs are not part of the rates
+  step_stats.samples.erase(step_stats.samples.begin(),
+                           step_stats.samples.begin() + session.config.warmup);
+  auto step_s = step_stats.median() / 1e9;
+  cout << "steps: " << steps << "\n";
+  cout << "steps/s: " << (step_s > 0 ? steps / step_s : 0.0) << "\n";
+  cout << "interactions/s: "
+       << (step_s > 0 ? (double)steps * num_bodies * num_bodies / step_s : 0.0) << "\n";
+
+  if (check) {
+    auto threshold = 0.001f;
+    cout << "check step: " << check_step << "\n";
+    pos_in = reinterpret_cast<float*>(check_pos_in.data());
+    vel_in = reinterpret_cast<float*>(check_vel_in.data());
+    auto pos_out = reinterpret_cast<float*>(check_pos_out.data());
+    auto vel_out = reinterpret_cast<float*>(check_vel_out.data());
+
+    BaseVerify verify(session.config);
+    auto ok = base_check_nbody(
+      verify, num_bodies, delT, espSqr, pos_in, vel_in, pos_out, vel_out, threshold);
+    verify.print();
+
+    if (ok) {
+      success(diff_ms);
+    } else {
+      failure(diff_ms);
+    }
+  } else {
+    cout << "Done\n";
+  }
+}
+
+void
+do_nbody_native(int tscheduler,
+                int tdevices,
+                uint check,
+                uint num_particles,
+                int chunksize,
+                bool use_binaries,
+                vector<float>& props)
+{
+  BaseSession session;
+  do_nbody_native(
+    session, tscheduler, tdevices, check, num_particles, chunksize, use_binaries, props);
+}
@@ -1,5 +1,6 @@
 void
-do_ray_base(int tscheduler,
+do_ray_base(BaseSession& session,
+            int tscheduler,
             int tdevices,
             uint check,
             int wsize,
@@ -9,13 +10,6 @@ do_ray_base(int tscheduler,
             string scene_path)
 {
 
-  string source_str;
-  try {
-    source_str = file_read("support/kernels/ray.cl");
-  } catch (std::ios::failure& e) {
-    cout << "io failure: " << e.what() << "\n";
-  }
-
   srand(0);
 
   data_t data;
@@ -27,6 +21,10 @@ do_ray_base(int tscheduler,
   data.total_size = image_size;
   data.scene = scene_path.c_str();
 
+  // a binary scene also brings its camera
+  BaseScene scene;
+  scene.load(data, scene_path);
+
   int depth = data.depth;
   int fast_norm = data.fast_norm;
   int buil_norm = data.buil_norm;
@@ -41,180 +39,350 @@ do_ray_base(int tscheduler,
   float camera_y = data.camera_y;
   float camera_z = data.camera_z;
 
-  ray_begin(&data);
-
   int n_primitives = data.n_primitives;
 
-  auto in_prim_list = make_shared<vector<Primitive>>(n_primitives);
-  in_prim_list.get()->assign(data.A, data.A + n_primitives);
-  auto in_ptr = reinterpret_cast<Primitive*>(in_prim_list.get()->data());
+  // uploaded from the scene itself, the mapping of a binary one
+  auto in_ptr = data.A;
 
-  auto out_pixels = make_shared<vector<Pixel>>(image_size);
-  out_pixels.get()->assign(data.C, data.C + image_size);
+  // every pixel is written by the kernel, data.C is only pointed at the result
+  auto out_pixels = make_shared<base_vector<Pixel>>(image_size);
+  auto c_ptr = data.C;
   auto out_ptr = reinterpret_cast<Pixel*>(out_pixels.get()->data());
 
   auto lws = 128;
   auto gws = image_size;
 
-  auto sel_platform = PLATFORM;
-  auto sel_device = DEVICE;
-
-  CUnits cunits;
-  set_cunits(cunits, use_binaries, tdevices, "ray", true, false);
-
-  auto time_init = std::chrono::system_clock::now().time_since_epoch();
-
-  set_cunits(cunits, use_binaries, tdevices, "ray", false, false);
-
-  vector<char> kernel_bin = move(cunits.kernel_bin);
-
-  sel_platform = cunits.sel_platform;
-  sel_device = cunits.sel_device;
-
-  auto in_bytes = n_primitives * sizeof(Primitive);
-  auto out_bytes = image_size * sizeof(Pixel);
-
-  vector<cl::Platform> platforms;
-  vector<vector<cl::Device>> platfordevices;
-  cl::Device device;
-
-  IF_LOGGING(cout << "discoverDevices\n");
-  cl::Platform::get(&platforms);
-  IF_LOGGING(cout << "platforms: " << platforms.size() << "\n");
-  auto i = 0;
-  for (auto& platform : platforms) {
-    vector<cl::Device> devices;
-    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-    IF_LOGGING(cout << "platform: " << i++ << " devices: " << devices.size() << "\n");
-    platfordevices.push_back(move(devices));
-  }
-
-  auto last_platform = platforms.size() - 1;
-  if (sel_platform > last_platform) {
-    throw runtime_error("invalid platform selected");
+  auto& accel = session.config.ray_accel;
+  if (accel != "list" && accel != "bvh") {
+    throw runtime_error("invalid ray acceleration: " + accel);
   }
-
-  auto last_device = platfordevices[sel_platform].size() - 1;
-  if (sel_device > last_device) {
-    throw runtime_error("invalid device selected");
+  auto use_bvh = accel == "bvh";
+  string name = use_bvh ? "ray_bvh" : "ray";
+  BaseBvh bvh;
+
+  string kernel_str = use_bvh ? "raytracer_bvh_kernel" : "raytracer_kernel";
+
+  // Animation: the camera moves along the path while the primitives, program
+  // and kernel stay resident; the last frame lands in out_pixels for the check.
+  auto path = base_parse_path(session.config.ray_path);
+  size_t frames = session.config.ray_frames ? session.config.ray_frames : path.size();
+  if (path.empty()) {
+    frames = 0;
   }
+  base_vector<Pixel> back_pixels(frames > 1 ? image_size : 0);
+  BaseStats latency_stats;
+  BaseStats frames_stats;
+
+  // linear interpolation between keyframes
+  auto camera_at = [&](size_t frame) {
+    if (path.size() == 1 || frames == 1) {
+      return path[0];
+    }
+    auto t = (double)frame * (path.size() - 1) / (frames - 1);
+    auto i = min((size_t)t, path.size() - 2);
+    auto u = (float)(t - i);
+    vector<float> camera(3);
+    for (int a = 0; a < 3; ++a) {
+      camera[a] = path[i][a] + u * (path[i + 1][a] - path[i][a]);
+    }
+    return camera;
+  };
+
+  auto measured = [&]() {
+    auto cold = !session.has_program(name);
+
+    string source_str;
+    CUnits cunits;
+    if (cold) {
+      try {
+        source_str = file_read("support/kernels/" + name + ".cl");
+      } catch (std::ios::failure& e) {
+        cout << "io failure: " << e.what() << "\n";
+      }
+      set_cunits(cunits, use_binaries, tdevices, name, true, false);
+    }
 
-  device = move(platfordevices[sel_platform][sel_device]);
-
-  cl_int cl_err = CL_SUCCESS;
-  cl::Context context(device);
-
-  cl::CommandQueue queue(context, device, 0, &cl_err);
-  CL_CHECK_ERROR(cl_err, "CommandQueue queue");
-
-  IF_LOGGING(cout << "initBuffers\n");
-
-  cl_int buffer_in_flags = CL_MEM_READ_WRITE;
-  cl_int buffer_out_flags = CL_MEM_READ_WRITE;
-
-  cl::Buffer in_buffer(context, buffer_in_flags, in_bytes, NULL);
-  CL_CHECK_ERROR(cl_err, "in buffer ");
-  cl::Buffer out_buffer(context, buffer_out_flags, out_bytes, NULL);
-  CL_CHECK_ERROR(cl_err, "out buffer ");
-
-  CL_CHECK_ERROR(queue.enqueueWriteBuffer(in_buffer, CL_FALSE, 0, in_bytes, in_ptr, NULL));
-
-  IF_LOGGING(cout << "initKernel\n");
-
-  cl::Program::Sources sources;
-  cl::Program::Binaries binaries;
-
-  cl::Program program;
-  if (use_binaries) {
-    binaries.push_back({ kernel_bin.data(), kernel_bin.size() });
-    vector<cl_int> status = { -1 };
-    program = std::move(cl::Program(context, { device }, binaries, &status, &cl_err));
-    CL_CHECK_ERROR(cl_err, "building program from binary failed for device ");
-  } else {
-    sources.push_back({ source_str.c_str(), source_str.length() });
-    program = std::move(cl::Program(context, sources));
-  }
-
-  string options;
-  options.reserve(32);
-  options += "-DECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED=" +
-    to_string(ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED);
-
-  cl_err = program.build({ device }, options.c_str());
-  if (cl_err != CL_SUCCESS) {
-    IF_LOGGING(cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)
-               << "\n");
-    CL_CHECK_ERROR(cl_err);
-  }
-
-  string kernel_str = "raytracer_kernel";
-  cl::Kernel kernel(program, kernel_str.c_str(), &cl_err);
-
-  cl_err = kernel.setArg(0, out_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 0");
-
-  cl_err = kernel.setArg(1, width);
-  CL_CHECK_ERROR(cl_err, "kernel arg 1");
-
-  cl_err = kernel.setArg(2, height);
-  CL_CHECK_ERROR(cl_err, "kernel arg 2");
-
-  cl_err = kernel.setArg(3, camera_x);
-  CL_CHECK_ERROR(cl_err, "kernel arg 3");
-
-  cl_err = kernel.setArg(4, camera_y);
-  CL_CHECK_ERROR(cl_err, "kernel arg 4");
-
-  cl_err = kernel.setArg(5, camera_z);
-  CL_CHECK_ERROR(cl_err, "kernel arg 5");
+    session.timer.start();
 
-  cl_err = kernel.setArg(6, viewp_w);
-  CL_CHECK_ERROR(cl_err, "kernel arg 6");
+    if (cold) {
+      set_cunits(cunits, use_binaries, tdevices, name, false, false);
+      session.timer.mark("set_cunits");
+      session.open(cunits);
+    }
 
-  cl_err = kernel.setArg(7, viewp_h);
-  CL_CHECK_ERROR(cl_err, "kernel arg 7");
+    if (use_bvh) {
+      bvh.build(in_ptr, n_primitives);
+      if (bvh.max_depth > 64) {
+        throw runtime_error("bvh deeper than the kernel traversal stack");
+      }
+      session.timer.mark("bvh");
+    }
 
-  cl_err = kernel.setArg(8, in_buffer);
-  CL_CHECK_ERROR(cl_err, "kernel arg 8");
+    auto in_bytes = n_primitives * sizeof(Primitive);
+    auto out_bytes = image_size * sizeof(Pixel);
 
-  cl_err = kernel.setArg(9, n_primitives);
-  CL_CHECK_ERROR(cl_err, "kernel arg 9");
+    auto setup = [&](BaseSession& unit, size_t index) {
+      cl_int cl_err = CL_SUCCESS;
 
-  cl_err = kernel.setArg(10, n_primitives * sizeof(Primitive), NULL);
-  CL_CHECK_ERROR(cl_err, "kernel arg 10");
+      IF_LOGGING(cout << "initBuffers\n");
 
-  auto offset = 0;
-  queue.enqueueNDRangeKernel(
-                             kernel, cl::NDRange(offset), cl::NDRange(gws), cl::NDRange(lws), NULL, NULL);
+      cl_int buffer_in_flags = CL_MEM_READ_WRITE;
+      cl_int buffer_out_flags = CL_MEM_READ_WRITE;
 
-  queue.enqueueReadBuffer(out_buffer, CL_TRUE, 0, out_bytes, out_ptr);
+      BaseLaunch launch;
+      // the bvh reorders the primitives, planes first
+      launch.buffers.emplace_back(
+        unit, buffer_in_flags, in_bytes, use_bvh ? bvh.prims.data() : in_ptr);
+      launch.buffers.emplace_back(unit, buffer_out_flags, out_bytes, out_ptr);
+      if (use_bvh) {
+        launch.buffers.emplace_back(
+          unit, CL_MEM_READ_ONLY, bvh.nodes.size() * sizeof(BaseBvhNode), bvh.nodes.data());
+        launch.buffers.emplace_back(
+          unit, CL_MEM_READ_ONLY, bvh.lights.size() * sizeof(cl_int), bvh.lights.data());
+      }
+      auto& in_buffer = launch.buffers[0];
+      auto& out_buffer = launch.buffers[1];
+      unit.timer.mark("buffers");
+
+      CL_CHECK_ERROR(launch.upload(unit, 0));
+      if (use_bvh) {
+        CL_CHECK_ERROR(launch.upload(unit, 2));
+        CL_CHECK_ERROR(launch.upload(unit, 3));
+      }
+      unit.timer.mark("write");
+
+      // the set_cunits binary only matches the first device
+      unit.load_program(name,
+                        source_str,
+                        index ? vector<char>() : move(cunits.kernel_bin),
+                        use_binaries && !index);
+
+      launch.kernel = unit.kernel(name, kernel_str);
+      auto& kernel = launch.kernel;
+      unit.timer.mark("build");
+
+      cl_err = kernel.setArg(0, out_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 0");
+
+      cl_err = kernel.setArg(1, width);
+      CL_CHECK_ERROR(cl_err, "kernel arg 1");
+
+      cl_err = kernel.setArg(2, height);
+      CL_CHECK_ERROR(cl_err, "kernel arg 2");
+
+      cl_err = kernel.setArg(3, camera_x);
+      CL_CHECK_ERROR(cl_err, "kernel arg 3");
+
+      cl_err = kernel.setArg(4, camera_y);
+      CL_CHECK_ERROR(cl_err, "kernel arg 4");
+
+      cl_err = kernel.setArg(5, camera_z);
+      CL_CHECK_ERROR(cl_err, "kernel arg 5");
+
+      cl_err = kernel.setArg(6, viewp_w);
+      CL_CHECK_ERROR(cl_err, "kernel arg 6");
+
+      cl_err = kernel.setArg(7, viewp_h);
+      CL_CHECK_ERROR(cl_err, "kernel arg 7");
+
+      cl_err = kernel.setArg(8, in_buffer.buffer);
+      CL_CHECK_ERROR(cl_err, "kernel arg 8");
+
+      cl_err = kernel.setArg(9, n_primitives);
+      CL_CHECK_ERROR(cl_err, "kernel arg 9");
+
+      if (use_bvh) {
+        cl_err = kernel.setArg(10, launch.buffers[2].buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 10");
+
+        cl_err = kernel.setArg(11, bvh.n_planes);
+        CL_CHECK_ERROR(cl_err, "kernel arg 11");
+
+        cl_err = kernel.setArg(12, launch.buffers[3].buffer);
+        CL_CHECK_ERROR(cl_err, "kernel arg 12");
+
+        cl_err = kernel.setArg(13, bvh.n_lights);
+        CL_CHECK_ERROR(cl_err, "kernel arg 13");
+
+        cl_err = kernel.setArg(14, depth);
+        CL_CHECK_ERROR(cl_err, "kernel arg 14");
+
+        launch.offset_arg = 15;
+        if (!ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED) {
+          cl_err = kernel.setArg(15, (cl_uint)0);
+          CL_CHECK_ERROR(cl_err, "kernel arg 15");
+        }
+        unit.timer.mark("args");
+        return launch;
+      }
+
+      cl_err = kernel.setArg(10, n_primitives * sizeof(Primitive), NULL);
+      CL_CHECK_ERROR(cl_err, "kernel arg 10");
+
+      launch.offset_arg = 11;
+      unit.timer.mark("args");
+      return launch;
+    };
+
+    if (frames) {
+      if (session.units().size() > 1) {
+        throw runtime_error("ray animation needs a single device");
+      }
+
+      auto launch = setup(session, 0);
+      CL_CHECK_ERROR(launch.sync(session), "barrier");
+      auto& kernel = launch.kernel;
+      auto& render_queue = session.queue_at(0);
+      auto& read_queue = session.queue_at(1);
+      cl_int cl_err = CL_SUCCESS;
+
+      // frame N reads back from one buffer while frame N+1 renders into the other
+      cl::Buffer back_buffer(session.context, CL_MEM_READ_WRITE, out_bytes, nullptr, &cl_err);
+      CL_CHECK_ERROR(cl_err, "buffer");
+      session.timer.count("device_bytes", out_bytes);
+      cl::Buffer frame_buffers[2] = { launch.buffers[1].buffer, back_buffer };
+      Pixel* frame_pixels[2] = { out_ptr, back_pixels.data() };
+      session.timer.mark("buffers");
+
+      typedef std::chrono::steady_clock clock;
+      vector<cl::Event> read_events(frames);
+      vector<clock::time_point> enqueued(frames);
+      latency_stats = BaseStats();
+      auto frames_init = clock::now();
+      for (size_t frame = 0; frame < frames; ++frame) {
+        auto slot = (frames - 1 - frame) % 2;
+        auto camera = camera_at(frame);
+
+        cl_err = kernel.setArg(0, frame_buffers[slot]);
+        CL_CHECK_ERROR(cl_err, "kernel arg 0");
+        for (int a = 0; a < 3; ++a) {
+          cl_err = kernel.setArg(3 + a, camera[a]);
+          CL_CHECK_ERROR(cl_err, "kernel arg camera");
+        }
+
+        // the buffer is free once the frame before last has been read back
+        vector<cl::Event> slot_free;
+        if (frame >= 2) {
+          slot_free.push_back(read_events[frame - 2]);
+        }
+        cl::Event rendered;
+        enqueued[frame] = clock::now();
+        cl_err = render_queue.enqueueNDRangeKernel(kernel,
+                                                   cl::NDRange(0),
+                                                   cl::NDRange(gws),
+                                                   cl::NDRange(lws),
+                                                   slot_free.empty() ? NULL : &slot_free,
+                                                   &rendered);
+        CL_CHECK_ERROR(cl_err, "enqueue kernel");
+        session.traced("kernel", render_queue, rendered);
+
+        vector<cl::Event> wait_rendered = { rendered };
+        cl_err = read_queue.enqueueReadBuffer(frame_buffers[slot],
+                                              CL_FALSE,
+                                              0,
+                                              out_bytes,
+                                              frame_pixels[slot],
+                                              &wait_rendered,
+                                              &read_events[frame]);
+        CL_CHECK_ERROR(cl_err, "read buffer");
+        session.traced("read", read_queue, read_events[frame]);
+        session.timer.count("bytes_copied", out_bytes);
+        render_queue.flush();
+        read_queue.flush();
+
+        // latency: enqueue to the frame being on the host
+        if (frame) {
+          read_events[frame - 1].wait();
+          latency_stats.add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - enqueued[frame - 1])
+              .count());
+        }
+      }
+      read_events[frames - 1].wait();
+      auto frames_end = clock::now();
+      latency_stats.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(frames_end - enqueued[frames - 1])
+          .count());
+      frames_stats.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(frames_end - frames_init).count());
+      session.timer.mark("frames");
+      session.timer.count("frames", frames);
+      return;
+    }
 
-  auto t2 = std::chrono::system_clock::now().time_since_epoch();
-  size_t diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - time_init).count();
+    // one work-item per output pixel
+    auto collect = [&](BaseSession& unit, BaseLaunch& launch, size_t offset, size_t size) {
+      return launch.download(unit, 1, offset * sizeof(Pixel), size * sizeof(Pixel));
+    };
 
-  cout << "time: " << diff_ms << "\n";
+    BaseCoexec coexec(session, tscheduler, chunksize, props);
+    coexec.tune_name = name;
+    coexec.run(gws, lws, setup, collect);
+  };
 
-  string m_info_buffer;
-  m_info_buffer.reserve(128);
-  CL_CHECK_ERROR(platforms[sel_platform].getInfo(CL_PLATFORM_NAME, &m_info_buffer));
+  size_t diff_ms = session.measure(name, measured);
 
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected platform: " << m_info_buffer << "\n";
-  CL_CHECK_ERROR(device.getInfo(CL_DEVICE_NAME, &m_info_buffer));
-  if (m_info_buffer.size() && m_info_buffer[m_info_buffer.size() - 1] == '\0')
-    m_info_buffer.erase(m_info_buffer.size() - 1, 1);
-  cout << "Selected device: " << m_info_buffer << "\n";
+  session.print_selected();
+  scene.print(n_primitives);
 
   cout << "program type: " << (use_binaries ? "binary" : "source") << "\n";
+  cout << "buffers: " << session.config.buffer_strategy << "\n";
   cout << "kernel: " << kernel_str << "\n";
+  if (frames) {
+    // warmup runs are not part of the rate, latencies are from the last run
+    frames_stats.samples.erase(frames_stats.samples.begin(),
+                               frames_stats.samples.begin() + session.config.warmup);
+    auto frames_s = frames_stats.median() / 1e9;
+    cout << "frames: " << frames << " fps: " << (frames_s > 0 ? frames / frames_s : 0.0) << "\n";
+    cout << "frame latency (us): min " << latency_stats.min() / 1000 << " median "
+         << latency_stats.median() / 1000 << " p95 " << latency_stats.percentile(95.0) / 1000
+         << " max " << latency_stats.max() / 1000 << "\n";
+
+    auto camera = camera_at(frames - 1);
+    data.camera_x = camera[0];
+    data.camera_y = camera[1];
+    data.camera_z = camera[2];
+  }
+  if (use_bvh) {
+    // the kernel runs until the blocking read returns
+    auto traversal_ns = session.timer.phase_ns("launch") + session.timer.phase_ns("read");
+    cout << "bvh: nodes " << bvh.nodes.size() << " leaves " << bvh.leaves << " depth "
+         << bvh.max_depth << " planes " << bvh.n_planes << "\n";
+    cout << "bvh build: " << session.timer.phase_ns("bvh") / 1000 << " us traversal "
+         << traversal_ns / 1000 << " us\n";
+  }
 
   if (check) {
     data.C = out_pixels.get()->data();
     data.out_file = "ray_base.bmp";
 
-    auto threshold = 0.01f;
-    auto pos = check_ray(&data);
+    // check_ray with sampling off, whatever the kernel. A sample is estimated
+    // with base_check_ray on a single-leaf hierarchy, which tests every
+    // primitive and so shares no traversal with ray_bvh.cl; every channel
+    // must be within threshold of full scale
+    BaseVerify verify(session.config);
+    long pos;
+    size_t pixels = (size_t)width * height;
+    if (verify.sampling(pixels)) {
+      auto threshold = 0.01f;
+      BaseBvh flat;
+      verify.serial([&]() {
+        flat.build(in_ptr, n_primitives, n_primitives);
+        return true;
+      });
+      pos = verify.sampled(
+        pixels,
+        [&](size_t pixel) {
+          return base_check_ray(out_ptr, flat, data, pixel, pixel + 1, threshold) == -1;
+        },
+        "pixels");
+      if (pos != -1) {
+        cout << "first mismatch: pixel " << pos << "\n";
+      }
+    } else {
+      pos = verify.serial([&]() { return check_ray(&data); });
+    }
+    verify.print();
     auto ok = pos == -1;
 
     if (ok) {
@@ -223,13 +391,31 @@ do_ray_base(int tscheduler,
       failure(diff_ms);
     }
     if (check == 2) {
-      ray_end(&data);
-      cout << "Writing to ray_base.bmp\n";
+      base_write_image(session.config,
+                       "ray_base.bmp",
+                       width,
+                       height,
+                       reinterpret_cast<const cl_uchar4*>(out_ptr),
+                       out_pixels);
     }
   } else {
     cout << "Done\n";
   }
 
-  free(data.C);
-  free(data.A);
+  free(c_ptr);
+}
+
+void
+do_ray_base(int tscheduler,
+            int tdevices,
+            uint check,
+            int wsize,
+            int chunksize,
+            bool use_binaries,
+            vector<float>& props,
+            string scene_path)
+{
+  BaseSession session;
+  do_ray_base(
+    session, tscheduler, tdevices, check, wsize, chunksize, use_binaries, props, scene_path);
 }
@@ -0,0 +1,30 @@
+// Converts a text scene into the binary format of base_scene.hpp, with the
+// camera defaults of data_t_init(); do_ray_base and do_ray_native load either.
+void
+do_ray_convert(string scene_path, string out_path)
+{
+  srand(0);
+
+  data_t data;
+  data_t_init(&data);
+  data.scene = scene_path.c_str();
+
+  BaseScene scene;
+  scene.load(data, scene_path);
+  if (scene.binary) {
+    throw runtime_error("scene is binary already: " + scene_path);
+  }
+
+  typedef std::chrono::steady_clock clock;
+  auto write_init = clock::now();
+  base_scene_write(out_path, data);
+  auto write_ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - write_init).count();
+
+  cout << "scene: " << scene_path << " primitives " << data.n_primitives << " parse "
+       << scene.load_ns / 1000 << " us\n";
+  cout << "wrote " << out_path << " " << base_scene_offset + data.n_primitives * sizeof(Primitive)
+       << " B in " << write_ns / 1000 << " us\n";
+
+  free(data.C);
+}
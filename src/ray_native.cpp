@@ -0,0 +1,124 @@
+void
+do_ray_native(BaseSession& session,
+              int tscheduler,
+              int tdevices,
+              uint check,
+              int wsize,
+              int chunksize,
+              bool use_binaries,
+              vector<float>& props,
+              string scene_path)
+{
+
+  srand(0);
+
+  data_t data;
+  data_t_init(&data);
+
+  data.width = wsize;
+  data.height = wsize;
+  auto image_size = wsize * wsize;
+  data.total_size = image_size;
+  data.scene = scene_path.c_str();
+
+  // a binary scene also brings its camera
+  BaseScene scene;
+  scene.load(data, scene_path);
+
+  int depth = data.depth;
+  int width = data.width;
+  int height = data.height;
+  float viewp_w = data.viewp_w;
+  float viewp_h = data.viewp_h;
+  float camera_x = data.camera_x;
+  float camera_y = data.camera_y;
+  float camera_z = data.camera_z;
+
+  int n_primitives = data.n_primitives;
+
+  auto out_pixels = make_shared<base_vector<Pixel>>(image_size);
+  auto out_ptr = reinterpret_cast<Pixel*>(out_pixels.get()->data());
+
+  // the host always traverses a BVH, rebuilt every run like in bvh mode
+  BaseBvh bvh;
+
+  // chunksize pixels per block handed to a thread (one row by default);
+  // tscheduler, tdevices, use_binaries and props only apply to devices
+  auto threads = base_native_threads(session.config);
+  size_t grain = chunksize > 0 ? chunksize : width;
+
+  auto measured = [&]() {
+    session.timer.start();
+
+    bvh.build(data.A, n_primitives);
+    session.timer.mark("bvh");
+
+    base_native_for(threads, image_size, grain, [&](size_t begin, size_t end) {
+      base_native_ray(out_ptr + begin,
+                      bvh,
+                      width,
+                      height,
+                      camera_x,
+                      camera_y,
+                      camera_z,
+                      viewp_w,
+                      viewp_h,
+                      depth,
+                      begin,
+                      end);
+    });
+    session.timer.mark("compute");
+  };
+
+  size_t diff_ms = session.measure("ray_native", measured);
+
+  cout << "native: " << base_native_isa() << " threads " << threads << "\n";
+  scene.print(n_primitives);
+  cout << "bvh: nodes " << bvh.nodes.size() << " leaves " << bvh.leaves << " depth "
+       << bvh.max_depth << " planes " << bvh.n_planes << "\n";
+
+  // data.C is pointed at the output for check_ray, keep the ray_begin buffer
+  auto c_ptr = data.C;
+  if (check) {
+    data.C = out_pixels.get()->data();
+    data.out_file = "ray_native.bmp";
+
+    BaseVerify verify(session.config);
+    auto pos = verify.serial([&]() { return check_ray(&data); });
+    verify.print();
+    auto ok = pos == -1;
+
+    if (ok) {
+      success(diff_ms);
+    } else {
+      failure(diff_ms);
+    }
+    if (check == 2) {
+      base_write_image(session.config,
+                       "ray_native.bmp",
+                       width,
+                       height,
+                       reinterpret_cast<const cl_uchar4*>(out_ptr),
+                       out_pixels);
+    }
+  } else {
+    cout << "Done\n";
+  }
+
+  free(c_ptr);
+}
+
+void
+do_ray_native(int tscheduler,
+              int tdevices,
+              uint check,
+              int wsize,
+              int chunksize,
+              bool use_binaries,
+              vector<float>& props,
+              string scene_path)
+{
+  BaseSession session;
+  do_ray_native(
+    session, tscheduler, tdevices, check, wsize, chunksize, use_binaries, props, scene_path);
+}
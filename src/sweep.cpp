@@ -0,0 +1,159 @@
+// One driver over the five benchmarks: config.sweep lists the sizes per
+// benchmark (binomial samples, gaussian image_width, mandelbrot width = height,
+// nbody num_particles, ray wsize), config.sweep_devices the tdevices values to
+// run them on. Each device keeps one session across its points, so with
+// ECL_BASE_WARMUP/ITERATIONS the times are warm medians. The arguments apply to
+// every point; see base_sweep.hpp for the results.
+void
+do_sweep(int tscheduler,
+         uint check,
+         int chunksize,
+         bool use_binaries,
+         vector<float>& props,
+         uint filter_width,
+         uint max_iterations,
+         string scene_path)
+{
+  auto config = BaseConfig::from_env();
+  auto sweep = base_parse_sweep(config.sweep);
+  if (sweep.empty()) {
+    throw runtime_error("empty sweep, set ECL_BASE_SWEEP");
+  }
+
+  vector<string> devices;
+  stringstream ss(config.sweep_devices);
+  string item;
+  while (getline(ss, item, ',')) {
+    devices.push_back(item);
+  }
+
+  BaseSweepReport report{ config.sweep_out };
+  for (auto& device : devices) {
+    auto native = device == "native";
+    auto tdevices = native ? 0 : stoi(device);
+    BaseSession session;
+
+    for (auto& entry : sweep) {
+      auto& bench = entry.first;
+      for (auto size : entry.second) {
+        int64_t items = 0;
+        try {
+          if (bench == "binomial") {
+            items = size;
+            if (native) {
+              do_binomial_native(
+                session, tscheduler, tdevices, check, size, chunksize, use_binaries, props);
+            } else {
+              do_binomial_base(
+                session, tscheduler, tdevices, check, size, chunksize, use_binaries, props);
+            }
+          } else if (bench == "gaussian") {
+            items = size * size;
+            if (native) {
+              do_gaussian_native(session,
+                                 tscheduler,
+                                 tdevices,
+                                 check,
+                                 size,
+                                 chunksize,
+                                 use_binaries,
+                                 props,
+                                 filter_width);
+            } else {
+              do_gaussian_base(session,
+                               tscheduler,
+                               tdevices,
+                               check,
+                               size,
+                               chunksize,
+                               use_binaries,
+                               props,
+                               filter_width);
+            }
+          } else if (bench == "mandelbrot") {
+            // width is rounded up to a multiple of 4, the view is set by the benchmark
+            items = ((size + 3) & ~3L) * size;
+            if (native) {
+              do_mandelbrot_native(session,
+                                   tscheduler,
+                                   tdevices,
+                                   check,
+                                   chunksize,
+                                   use_binaries,
+                                   props,
+                                   size,
+                                   size,
+                                   0.0,
+                                   0.0,
+                                   0.0,
+                                   0.0,
+                                   max_iterations);
+            } else {
+              do_mandelbrot_base(session,
+                                 tscheduler,
+                                 tdevices,
+                                 check,
+                                 chunksize,
+                                 use_binaries,
+                                 props,
+                                 size,
+                                 size,
+                                 0.0,
+                                 0.0,
+                                 0.0,
+                                 0.0,
+                                 max_iterations);
+            }
+          } else if (bench == "nbody") {
+            // rounded to whole groups
+            items = max<long>(size, GROUP_SIZE) / GROUP_SIZE * GROUP_SIZE;
+            if (native) {
+              do_nbody_native(
+                session, tscheduler, tdevices, check, size, chunksize, use_binaries, props);
+            } else {
+              do_nbody_base(
+                session, tscheduler, tdevices, check, size, chunksize, use_binaries, props);
+            }
+          } else if (bench == "ray") {
+            items = size * size;
+            if (native) {
+              do_ray_native(session,
+                            tscheduler,
+                            tdevices,
+                            check,
+                            size,
+                            chunksize,
+                            use_binaries,
+                            props,
+                            scene_path);
+            } else {
+              do_ray_base(session,
+                          tscheduler,
+                          tdevices,
+                          check,
+                          size,
+                          chunksize,
+                          use_binaries,
+                          props,
+                          scene_path);
+            }
+          } else {
+            throw runtime_error("invalid sweep benchmark: " + bench);
+          }
+          report.add(base_sweep_row(session, bench, device, use_binaries, size, items));
+        } catch (runtime_error& e) {
+          // e.g. out of device memory, the larger sizes may still fit elsewhere
+          BaseSweepRow row;
+          row.bench = bench;
+          row.device = device;
+          row.size = size;
+          row.items = items;
+          row.error = e.what();
+          report.add(row);
+        }
+      }
+    }
+    session.report();
+  }
+  report.report();
+}
@@ -0,0 +1,97 @@
+// Binomial option lattice of any depth (see do_binomial_base).
+//
+// binomial_options prices a cl_float4 of options per work-group of steps + 1
+// items, so steps is bounded by the work-group size. Here each work-group
+// owns a lattice of steps + 1 nodes in global memory and prices the option
+// vectors [group * per_group, (group + 1) * per_group) one after the other.
+// Backward induction goes block levels at a time: the level is swept in tiles
+// of the work-group size staged in local memory, and a tile of width nodes
+// yields width - block nodes of the level block steps down. Tiles go from the
+// left, so a tile only overwrites nodes the next one no longer reads.
+
+#ifndef ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED
+#define ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED 1
+#endif
+
+#define RISKFREE 0.02f
+#define VOLATILITY 0.30f
+
+__kernel void
+binomial_blocked(int steps,
+                 __global const float4* randArray,
+                 __global float4* output,
+                 __global float4* lattice,
+                 __local float4* tile,
+                 uint vectors,
+                 uint per_group,
+                 uint block
+#if ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED == 0
+                 ,
+                 uint offset
+#endif
+)
+{
+#if ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED == 0
+  size_t gid = get_global_id(0) + offset;
+#else
+  size_t gid = get_global_id(0);
+#endif
+  uint width = get_local_size(0);
+  uint lid = get_local_id(0);
+  uint group = gid / width;
+  __global float4* call = lattice + (size_t)group * (steps + 1);
+
+  uint first = group * per_group;
+  uint last = min(first + per_group, vectors);
+  for (uint v = first; v < last; ++v) {
+    float4 r = randArray[v];
+    float4 s = (1.0f - r) * 5.0f + r * 30.0f;
+    float4 x = (1.0f - r) * 1.0f + r * 100.0f;
+    float4 optionYears = (1.0f - r) * 0.25f + r * 10.0f;
+    float4 dt = optionYears * (1.0f / (float)steps);
+    float4 vsdt = VOLATILITY * sqrt(dt);
+    float4 rate = exp(RISKFREE * dt);
+    float4 u = exp(vsdt);
+    float4 d = 1.0f / u;
+    float4 pu = (rate - d) / (u - d);
+    float4 pd = 1.0f - pu;
+    float4 puByr = pu / rate;
+    float4 pdByr = pd / rate;
+
+    for (uint t = lid; t <= (uint)steps; t += width) {
+      float4 profit = s * exp(vsdt * (2.0f * t - (float)steps)) - x;
+      call[t] = max(profit, 0.0f);
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    // level j has nodes [0, j]
+    uint j = steps;
+    while (j > 0) {
+      uint levels = min(block, j);
+      uint nodes = j - levels + 1;
+      for (uint base = 0; base < nodes; base += width - levels) {
+        uint t = base + lid;
+        tile[lid] = t <= j ? call[t] : (float4)(0.0f);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        // node lid stays exact while lid < width - k
+        for (uint k = 0; k < levels; ++k) {
+          float4 next = lid + 1 < width ? puByr * tile[lid] + pdByr * tile[lid + 1] : tile[lid];
+          barrier(CLK_LOCAL_MEM_FENCE);
+          tile[lid] = next;
+          barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (lid < width - levels && t < nodes) {
+          call[t] = tile[lid];
+        }
+      }
+      barrier(CLK_GLOBAL_MEM_FENCE);
+      j -= levels;
+    }
+
+    if (lid == 0) {
+      output[v] = call[0];
+    }
+    // the next option vector reuses the lattice
+    barrier(CLK_GLOBAL_MEM_FENCE);
+  }
+}
@@ -0,0 +1,52 @@
+// Separable Gaussian blur: a horizontal pass into a float intermediate and a
+// vertical pass back to uchar4, O(filter_width) per pixel instead of
+// O(filter_width^2). filter holds the 1D weights (row sums of the 2D filter).
+// Borders are clamped per axis, which matches clamping in the 2D filter.
+
+__kernel void
+gaussian_blur_rows(__global float4* tmp,
+                   __global const uchar4* input,
+                   int rows,
+                   int cols,
+                   __global const float* filter,
+                   int filter_width)
+{
+  int tid = get_global_id(0);
+  if (tid >= rows * cols) {
+    return;
+  }
+  int r = tid / cols;
+  int c = tid % cols;
+  int middle = filter_width / 2;
+
+  float4 blur = (float4)(0.0f);
+  for (int j = -middle; j <= middle; ++j) {
+    int w = clamp(c + j, 0, cols - 1);
+    blur += filter[j + middle] * convert_float4(input[r * cols + w]);
+  }
+  tmp[tid] = blur;
+}
+
+__kernel void
+gaussian_blur_cols(__global uchar4* blurred,
+                   __global const float4* tmp,
+                   int rows,
+                   int cols,
+                   __global const float* filter,
+                   int filter_width)
+{
+  int tid = get_global_id(0);
+  if (tid >= rows * cols) {
+    return;
+  }
+  int r = tid / cols;
+  int c = tid % cols;
+  int middle = filter_width / 2;
+
+  float4 blur = (float4)(0.0f);
+  for (int i = -middle; i <= middle; ++i) {
+    int h = clamp(r + i, 0, rows - 1);
+    blur += filter[i + middle] * tmp[h * cols + c];
+  }
+  blurred[tid] = convert_uchar4_sat_rte(blur);
+}
@@ -0,0 +1,71 @@
+// Perturbation deep-zoom Mandelbrot (see src/base_mandelbrot.hpp).
+//
+// Each work-item computes 4 consecutive pixels. Pixels iterate their float
+// delta against the host reference orbit and rebase to the orbit start on a
+// glitch (|Z + d| < |d|) or when the orbit ends.
+
+#ifndef ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED
+#define ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED 1
+#endif
+
+uint
+perturb_iterations(__global const float2* orbit, uint orbit_len, float2 dc, uint max_iterations)
+{
+  float2 d = (float2)(0.0f, 0.0f);
+  uint n = 0;
+  for (uint iter = 0; iter < max_iterations; ++iter) {
+    float2 t = 2.0f * orbit[n] + d;
+    d = (float2)(t.x * d.x - t.y * d.y, t.x * d.y + t.y * d.x) + dc;
+    n++;
+    float2 z = orbit[n] + d;
+    float zn = dot(z, z);
+    if (zn > 4.0f) {
+      return iter + 1;
+    }
+    if (zn < dot(d, d) || n == orbit_len - 1) {
+      d = z;
+      n = 0;
+    }
+  }
+  return max_iterations;
+}
+
+uchar4
+perturb_color(uint iter, uint max_iterations)
+{
+  if (iter >= max_iterations) {
+    return (uchar4)(0, 0, 0, 255);
+  }
+  return (uchar4)(iter * 7 % 256, iter * 3 % 256, iter * 11 % 256, 255);
+}
+
+__kernel void
+mandelbrot_perturb(__global uchar4* out,
+                   __global const float2* orbit,
+                   uint orbit_len,
+                   float dcx0,
+                   float dcy0,
+                   float xstep,
+                   float ystep,
+                   uint max_iterations,
+                   int width
+#if ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED == 0
+                   ,
+                   uint offset
+#endif
+)
+{
+#if ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED == 0
+  size_t tid = get_global_id(0) + offset;
+#else
+  size_t tid = get_global_id(0);
+#endif
+
+  for (int i = 0; i < 4; ++i) {
+    size_t pixel = 4 * tid + i;
+    int x = pixel % width;
+    int y = pixel / width;
+    float2 dc = (float2)(dcx0 + x * xstep, dcy0 + y * ystep);
+    out[pixel] = perturb_color(perturb_iterations(orbit, orbit_len, dc, max_iterations), max_iterations);
+  }
+}
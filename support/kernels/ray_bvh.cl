@@ -0,0 +1,364 @@
+// Ray tracer traversing a BVH (see src/base_bvh.hpp) instead of testing every
+// primitive from local memory.
+//
+// Shading follows raytracer_kernel: diffuse and specular light from every
+// light primitive with shadow rays, plus reflection and refraction rays up to
+// depth bounces. OpenCL has no recursion, so secondary rays go on a small
+// stack with the weight they contribute to the pixel.
+
+#ifndef ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED
+#define ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED 1
+#endif
+
+#define RAY_SPHERE 1
+#define RAY_PLANE 2
+#define RAY_EPSILON 0.0001f
+#define RAY_MISS 0
+#define RAY_HIT 1
+#define RAY_INSIDE -1
+#define BVH_STACK 64
+#define RAY_STACK 16
+
+// same layout as the host Primitive
+typedef struct
+{
+  float m_color[3];
+  float m_refl;
+  float m_diff;
+  float m_refr;
+  float m_refr_index;
+  float m_spec;
+  float dummy_3;
+  int type;
+  char is_light;
+  float normal[4];
+  float center[4];
+  float depth;
+  float radius;
+  float sq_radius;
+  float r_radius;
+} Primitive;
+
+typedef uchar4 Pixel;
+
+typedef struct
+{
+  float lo[3];
+  int left_first;
+  float hi[3];
+  int count;
+} BvhNode;
+
+typedef struct
+{
+  float3 origin;
+  float3 dir;
+  float3 weight;
+  // color of the primitive the ray leaves, for refraction absorbance
+  float3 absorb;
+  float rindex;
+  int depth;
+  int refracted;
+} Ray;
+
+int
+intersect(__global const Primitive* p, float3 origin, float3 dir, float* dist)
+{
+  if (p->type == RAY_SPHERE) {
+    float3 v = origin - (float3)(p->center[0], p->center[1], p->center[2]);
+    float b = -dot(v, dir);
+    float det = b * b - dot(v, v) + p->sq_radius;
+    if (det > 0.0f) {
+      det = sqrt(det);
+      float i1 = b - det;
+      float i2 = b + det;
+      if (i2 > 0.0f) {
+        if (i1 < 0.0f) {
+          if (i2 < *dist) {
+            *dist = i2;
+            return RAY_INSIDE;
+          }
+        } else if (i1 < *dist) {
+          *dist = i1;
+          return RAY_HIT;
+        }
+      }
+    }
+    return RAY_MISS;
+  }
+
+  float3 n = (float3)(p->normal[0], p->normal[1], p->normal[2]);
+  float d = dot(n, dir);
+  if (d != 0.0f) {
+    float t = -(dot(n, origin) + p->depth) / d;
+    if (t > 0.0f && t < *dist) {
+      *dist = t;
+      return RAY_HIT;
+    }
+  }
+  return RAY_MISS;
+}
+
+float
+slab(__global const BvhNode* node, float3 origin, float3 inv_dir, float dist)
+{
+  float3 lo = ((float3)(node->lo[0], node->lo[1], node->lo[2]) - origin) * inv_dir;
+  float3 hi = ((float3)(node->hi[0], node->hi[1], node->hi[2]) - origin) * inv_dir;
+  float3 tmin = fmin(lo, hi);
+  float3 tmax = fmax(lo, hi);
+  float t0 = max(max(tmin.x, tmin.y), max(tmin.z, 0.0f));
+  float t1 = min(min(tmax.x, tmax.y), min(tmax.z, dist));
+  return t0 <= t1 ? t0 : INFINITY;
+}
+
+// nearest primitive along the ray, -1 if none; shadow stops at the first
+// non-light occluder
+int
+nearest(__global const Primitive* prims,
+        int n_primitives,
+        __global const BvhNode* nodes,
+        int n_planes,
+        float3 origin,
+        float3 dir,
+        float* dist,
+        int* result,
+        bool shadow)
+{
+  int hit = -1;
+  for (int i = 0; i < n_planes; ++i) {
+    int r = intersect(prims + i, origin, dir, dist);
+    if (r != RAY_MISS) {
+      hit = i;
+      *result = r;
+      if (shadow && !prims[i].is_light) {
+        return hit;
+      }
+    }
+  }
+
+  float3 inv_dir = 1.0f / dir;
+  int stack[BVH_STACK];
+  int top = 0;
+  // no spheres, no tree
+  if (n_primitives > n_planes) {
+    stack[top++] = 0;
+  }
+  while (top) {
+    __global const BvhNode* node = nodes + stack[--top];
+    if (slab(node, origin, inv_dir, *dist) == INFINITY) {
+      continue;
+    }
+    if (node->count) {
+      for (int i = node->left_first; i < node->left_first + node->count; ++i) {
+        int r = intersect(prims + i, origin, dir, dist);
+        if (r != RAY_MISS) {
+          hit = i;
+          *result = r;
+          if (shadow && !prims[i].is_light) {
+            return hit;
+          }
+        }
+      }
+      continue;
+    }
+    // nearer child on top of the stack
+    int left = node->left_first;
+    float tl = slab(nodes + left, origin, inv_dir, *dist);
+    float tr = slab(nodes + left + 1, origin, inv_dir, *dist);
+    if (tl <= tr) {
+      if (tr != INFINITY) {
+        stack[top++] = left + 1;
+      }
+      if (tl != INFINITY) {
+        stack[top++] = left;
+      }
+    } else {
+      if (tl != INFINITY) {
+        stack[top++] = left;
+      }
+      stack[top++] = left + 1;
+    }
+  }
+  return hit;
+}
+
+float3
+color_of(__global const Primitive* p)
+{
+  return (float3)(p->m_color[0], p->m_color[1], p->m_color[2]);
+}
+
+float3
+normal_at(__global const Primitive* p, float3 point)
+{
+  if (p->type == RAY_SPHERE) {
+    return (point - (float3)(p->center[0], p->center[1], p->center[2])) * p->r_radius;
+  }
+  return (float3)(p->normal[0], p->normal[1], p->normal[2]);
+}
+
+float3
+trace(__global const Primitive* prims,
+      int n_primitives,
+      __global const BvhNode* nodes,
+      int n_planes,
+      __global const int* lights,
+      int n_lights,
+      int max_depth,
+      float3 origin,
+      float3 dir)
+{
+  float3 acc = (float3)(0.0f);
+  Ray stack[RAY_STACK];
+  int top = 0;
+  stack[top].origin = origin;
+  stack[top].dir = dir;
+  stack[top].weight = (float3)(1.0f);
+  stack[top].absorb = (float3)(0.0f);
+  stack[top].rindex = 1.0f;
+  stack[top].depth = 1;
+  stack[top].refracted = 0;
+  top++;
+
+  while (top) {
+    Ray ray = stack[--top];
+    float dist = 1000000.0f;
+    int result = RAY_MISS;
+    int hit = nearest(
+      prims, n_primitives, nodes, n_planes, ray.origin, ray.dir, &dist, &result, false);
+    if (hit < 0) {
+      continue;
+    }
+    __global const Primitive* p = prims + hit;
+    float3 weight = ray.weight;
+    if (ray.refracted) {
+      weight *= exp(ray.absorb * 0.15f * -dist);
+    }
+    if (p->is_light) {
+      acc += weight;
+      continue;
+    }
+
+    float3 point = ray.origin + ray.dir * dist;
+    float3 n = normal_at(p, point);
+    float3 color = color_of(p);
+
+    for (int l = 0; l < n_lights; ++l) {
+      __global const Primitive* light = prims + lights[l];
+      float3 to_light = (float3)(light->center[0], light->center[1], light->center[2]) - point;
+      float light_dist = length(to_light);
+      to_light /= light_dist;
+
+      float shade = 1.0f;
+      float shadow_dist = light_dist;
+      int shadow_result = RAY_MISS;
+      int occluder = nearest(prims,
+                             n_primitives,
+                             nodes,
+                             n_planes,
+                             point + to_light * RAY_EPSILON,
+                             to_light,
+                             &shadow_dist,
+                             &shadow_result,
+                             true);
+      if (occluder >= 0 && !prims[occluder].is_light) {
+        shade = 0.0f;
+      }
+
+      float3 light_color = color_of(light);
+      if (p->m_diff > 0.0f) {
+        float d = dot(n, to_light);
+        if (d > 0.0f) {
+          acc += weight * (d * p->m_diff * shade) * color * light_color;
+        }
+      }
+      if (p->m_spec > 0.0f) {
+        float3 r = to_light - 2.0f * dot(to_light, n) * n;
+        float d = dot(ray.dir, r);
+        if (d > 0.0f) {
+          acc += weight * (pow(d, 20.0f) * p->m_spec * shade) * light_color;
+        }
+      }
+    }
+
+    if (ray.depth >= max_depth) {
+      continue;
+    }
+    if (p->m_refl > 0.0f && top < RAY_STACK) {
+      float3 r = ray.dir - 2.0f * dot(ray.dir, n) * n;
+      stack[top].origin = point + r * RAY_EPSILON;
+      stack[top].dir = r;
+      stack[top].weight = weight * p->m_refl * color;
+      stack[top].absorb = (float3)(0.0f);
+      stack[top].rindex = ray.rindex;
+      stack[top].depth = ray.depth + 1;
+      stack[top].refracted = 0;
+      top++;
+    }
+    if (p->m_refr > 0.0f && top < RAY_STACK) {
+      float rindex = p->m_refr_index;
+      float ratio = ray.rindex / rindex;
+      float3 nn = n * (float)result;
+      float cos_i = -dot(nn, ray.dir);
+      float cos_t2 = 1.0f - ratio * ratio * (1.0f - cos_i * cos_i);
+      if (cos_t2 > 0.0f) {
+        float3 t = ratio * ray.dir + (ratio * cos_i - sqrt(cos_t2)) * nn;
+        stack[top].origin = point + t * RAY_EPSILON;
+        stack[top].dir = t;
+        stack[top].weight = weight;
+        stack[top].absorb = color;
+        stack[top].rindex = rindex;
+        stack[top].depth = ray.depth + 1;
+        stack[top].refracted = 1;
+        top++;
+      }
+    }
+  }
+  return acc;
+}
+
+__kernel void
+raytracer_bvh_kernel(__global Pixel* out,
+                     int width,
+                     int height,
+                     float camera_x,
+                     float camera_y,
+                     float camera_z,
+                     float viewp_w,
+                     float viewp_h,
+                     __global const Primitive* prims,
+                     int n_primitives,
+                     __global const BvhNode* nodes,
+                     int n_planes,
+                     __global const int* lights,
+                     int n_lights,
+                     int depth
+#if ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED == 0
+                     ,
+                     uint offset
+#endif
+)
+{
+#if ECL_KERNEL_GLOBAL_WORK_OFFSET_SUPPORTED == 0
+  int idx = get_global_id(0) + offset;
+#else
+  int idx = get_global_id(0);
+#endif
+  if (idx >= width * height) {
+    return;
+  }
+  int x = idx % width;
+  int y = idx / width;
+
+  float dx = viewp_w / width;
+  float dy = viewp_h / height;
+  float3 origin = (float3)(camera_x, camera_y, camera_z);
+  float3 target = (float3)(-viewp_w / 2.0f + x * dx, viewp_h / 2.0f - y * dy, 0.0f);
+  float3 dir = normalize(target - origin);
+
+  float3 c = trace(prims, n_primitives, nodes, n_planes, lights, n_lights, depth, origin, dir);
+  out[idx] = (Pixel)(convert_uchar_sat(c.x * 255.0f),
+                     convert_uchar_sat(c.y * 255.0f),
+                     convert_uchar_sat(c.z * 255.0f),
+                     255);
+}